@@ -0,0 +1,75 @@
+// Memory reserved once, at startup, for the bounded-memory mode of the book.
+// mmap'd anonymous memory, backed by explicit huge pages (MAP_HUGETLB, 2 MiB)
+//  when the system has some reserved, otherwise by normal pages with a
+//  Transparent Huge Pages hint. Either way fewer TLB entries cover the tables.
+// Pages are faulted in up front (MAP_POPULATE, or a memset): the first use of
+//  a page on the command path doesn't pay a page fault.
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+// POSIX
+#include <sys/mman.h>
+
+
+class Arena
+{
+  public:
+    static constexpr size_t huge_page_size{2 * 1024 * 1024};
+
+    explicit Arena(size_t bytes);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* data() const
+    {
+        return m_memory;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    // True if MAP_HUGETLB worked, false if it's normal pages (THP maybe).
+    bool huge_pages() const
+    {
+        return m_huge_pages;
+    }
+
+  private:
+    void* m_memory;
+    size_t m_size;
+    bool m_huge_pages;
+};
+
+Arena::Arena(size_t bytes)
+{
+    // Whole huge pages, so that both kinds of mapping have the same size.
+    m_size = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+
+    m_memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    m_huge_pages = m_memory != MAP_FAILED;
+    if (!m_huge_pages)
+    {
+        m_memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m_memory == MAP_FAILED)
+        {
+            throw std::runtime_error{"mmap() failed for an arena of " +
+              std::to_string(m_size) + " bytes"};
+        }
+        // Only a hint, ignored if THP is disabled. Given before the pages are
+        //  touched, so that the faults below can already get huge ones.
+        madvise(m_memory, m_size, MADV_HUGEPAGE);
+        std::memset(m_memory, 0, m_size);
+    }
+}
+
+Arena::~Arena()
+{
+    munmap(m_memory, m_size);
+}
@@ -0,0 +1,395 @@
+// Workloads for book_bench: recorded command files (text or binary), read 
+//  through mmap, and a synthetic generator with a few realistic mixes.
+// Text format: one command per line, same syntax as the console 
+//  (e.g. "CREATE 1 1 BUY 1 1"). Binary format: a WorkloadHeader followed by 
+//  'count' fixed-size BinaryCommand records.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+// POSIX
+#include <sys/mman.h> // For mmap().
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+// Custom
+#include "../../../order_book.hpp"
+
+
+enum class CommandType : uint8_t
+{
+    CREATE,
+    DELETE,
+    MODIFY,
+    GET,
+    AGGREGATED_BEST,
+    COUNT // Number of types, not a command.
+};
+
+inline const char* command_name(CommandType type)
+{
+    static const char* names[] = {"CREATE", "DELETE", "MODIFY", "GET", 
+      "AGGREGATED_BEST"};
+    return names[static_cast<size_t>(type)];
+}
+
+// One command already tokenized: what the direct OrderBook replay consumes.
+struct Command
+{
+    CommandType type;
+    Order::Verb verb;
+    uint32_t price;
+    uint32_t quantity;
+    std::string orderID;
+    std::string productID;
+
+    // Back to the console syntax: the parser replay and the text files use it.
+    std::string to_line() const
+    {
+        std::ostringstream oss;
+        oss << command_name(type);
+        switch (type)
+        {
+            case CommandType::CREATE:
+                oss << " " << orderID << " " << productID << " " << 
+                  (verb == Order::Verb::BUY ? "BUY" : "SELL") << " " << price << 
+                  " " << quantity;
+                break;
+            case CommandType::MODIFY:
+                oss << " " << orderID << " " << price << " " << quantity;
+                break;
+            case CommandType::AGGREGATED_BEST:
+                oss << " " << productID;
+                break;
+            default:
+                oss << " " << orderID;
+                break;
+        }
+        return oss.str();
+    }
+};
+
+// Binary records: fixed size, IDs up to 15 chars, '\0'-padded.
+struct WorkloadHeader
+{
+    static constexpr char magic_value[8] = {'O', 'B', 'B', 'E', 'N', 'C', 'H', 
+      '1'};
+
+    char magic[8];
+    uint64_t count;
+};
+struct BinaryCommand
+{
+    uint8_t type;
+    uint8_t verb;
+    uint8_t padding[2];
+    uint32_t price;
+    uint32_t quantity;
+    char orderID[16];
+    char productID[16];
+};
+static_assert(sizeof(BinaryCommand) == 44);
+
+// Parses a console line. False if the command isn't one the bench replays.
+inline bool parse_command(const std::string& line, Command& command)
+{
+    std::stringstream ss{line};
+    std::string name, verb_s;
+    ss >> name;
+    command = Command{};
+    if (name == "CREATE")
+    {
+        command.type = CommandType::CREATE;
+        ss >> command.orderID >> command.productID >> verb_s >> command.price >> 
+          command.quantity;
+        command.verb = verb_s == "BUY" ? Order::Verb::BUY : Order::Verb::SELL;
+    }
+    else if (name == "DELETE" || name == "GET")
+    {
+        command.type = name == "GET" ? CommandType::GET : CommandType::DELETE;
+        ss >> command.orderID;
+    }
+    else if (name == "MODIFY")
+    {
+        command.type = CommandType::MODIFY;
+        ss >> command.orderID >> command.price >> command.quantity;
+    }
+    else if (name == "AGGREGATED_BEST")
+    {
+        command.type = CommandType::AGGREGATED_BEST;
+        ss >> command.productID;
+    }
+    else
+    {
+        return false;
+    }
+
+    return !ss.fail();
+}
+
+// Read-only mapping of a whole file.
+class MappedFile
+{
+  public:
+    explicit MappedFile(const std::string& filename)
+    {
+        auto fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error{"Cannot open " + filename};
+        }
+        struct stat info;
+        fstat(fd, &info);
+        m_size = info.st_size;
+        m_data = m_size == 0 ? nullptr : 
+          mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m_data == MAP_FAILED)
+        {
+            throw std::runtime_error{"Cannot mmap " + filename};
+        }
+        if (m_data != nullptr)
+        {
+            madvise(m_data, m_size, MADV_SEQUENTIAL);
+        }
+    }
+    ~MappedFile()
+    {
+        if (m_data != nullptr)
+        {
+            munmap(m_data, m_size);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const
+    {
+        return static_cast<const char*>(m_data);
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+
+  private:
+    void* m_data;
+    size_t m_size;
+};
+
+// Loads a text or binary command file (told apart by the magic).
+inline std::vector<Command> load_workload(const std::string& filename)
+{
+    MappedFile file{filename};
+    std::vector<Command> commands;
+
+    if (file.size() >= sizeof(WorkloadHeader) && std::memcmp(file.data(), 
+      WorkloadHeader::magic_value, sizeof(WorkloadHeader::magic_value)) == 0)
+    {
+        WorkloadHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (file.size() < sizeof(header) + header.count * sizeof(BinaryCommand))
+        {
+            throw std::runtime_error{"Truncated workload: " + filename};
+        }
+        commands.reserve(header.count);
+        auto record = file.data() + sizeof(header);
+        for (uint64_t i = 0; i < header.count; i++, 
+          record += sizeof(BinaryCommand))
+        {
+            BinaryCommand binary;
+            std::memcpy(&binary, record, sizeof(binary));
+            Command command;
+            command.type = static_cast<CommandType>(binary.type);
+            command.verb = static_cast<Order::Verb>(binary.verb);
+            command.price = binary.price;
+            command.quantity = binary.quantity;
+            command.orderID.assign(binary.orderID, 
+              strnlen(binary.orderID, sizeof(binary.orderID)));
+            command.productID.assign(binary.productID, 
+              strnlen(binary.productID, sizeof(binary.productID)));
+            commands.push_back(std::move(command));
+        }
+        return commands;
+    }
+
+    // Text: one command per line, unknown lines skipped.
+    const char* begin = file.data();
+    const char* end = begin + file.size();
+    while (begin < end)
+    {
+        auto newline = static_cast<const char*>(
+          std::memchr(begin, '\n', end - begin));
+        auto line_end = newline == nullptr ? end : newline;
+        Command command;
+        if (parse_command(std::string(begin, line_end), command))
+        {
+            commands.push_back(std::move(command));
+        }
+        begin = line_end + 1;
+    }
+    return commands;
+}
+
+inline void store_workload(const std::string& filename, 
+  const std::vector<Command>& commands, bool binary)
+{
+    std::ofstream file{filename, std::ios::binary};
+    if (!file)
+    {
+        throw std::runtime_error{"Cannot create " + filename};
+    }
+
+    if (!binary)
+    {
+        for (const auto& command : commands)
+        {
+            file << command.to_line() << "\n";
+        }
+        return;
+    }
+
+    WorkloadHeader header;
+    std::memcpy(header.magic, WorkloadHeader::magic_value, sizeof(header.magic));
+    header.count = commands.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& command : commands)
+    {
+        BinaryCommand record{};
+        record.type = static_cast<uint8_t>(command.type);
+        record.verb = static_cast<uint8_t>(command.verb);
+        record.price = command.price;
+        record.quantity = command.quantity;
+        std::strncpy(record.orderID, command.orderID.c_str(), 
+          sizeof(record.orderID) - 1);
+        std::strncpy(record.productID, command.productID.c_str(), 
+          sizeof(record.productID) - 1);
+        file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+}
+
+// Synthetic mixes. Weights are relative, per command type.
+struct WorkloadProfile
+{
+    const char* name;
+    uint32_t products;
+    uint32_t weights[static_cast<size_t>(CommandType::COUNT)];
+    uint32_t price_spread; // Ticks around the mid where orders land.
+    uint32_t target_live_orders; // Creates are favoured below, deletes above.
+};
+
+inline const std::vector<WorkloadProfile>& workload_profiles()
+{
+    //                                           CREATE DELETE MODIFY GET BEST
+    static const std::vector<WorkloadProfile> profiles = {
+        // Market makers quoting and pulling: most orders die young.
+        {"cancel-heavy",  16,     {45, 42, 8, 2, 3},    50, 10'000},
+        // Activity packed at the best levels, lots of polling of the touch.
+        {"touch-heavy",   8,      {25, 20, 20, 5, 30},  3,  5'000},
+        // Wide universe: every product is thin, lookups are cold.
+        {"many-products", 20'000, {40, 35, 10, 5, 10},  20, 200'000},
+    };
+    return profiles;
+}
+
+inline std::vector<Command> generate_workload(const WorkloadProfile& profile, 
+  size_t count, uint64_t seed = 1)
+{
+    std::mt19937_64 random{seed};
+    std::discrete_distribution<int> pick_type(std::begin(profile.weights), 
+      std::end(profile.weights));
+    std::uniform_int_distribution<uint32_t> pick_product(0, 
+      profile.products - 1);
+    std::uniform_int_distribution<uint32_t> pick_offset(0, profile.price_spread);
+    std::uniform_int_distribution<uint32_t> pick_quantity(1, 100);
+
+    // Mid price per product, random walk.
+    std::vector<uint32_t> mid(profile.products, 10'000);
+    // Live orders, so DELETE/MODIFY/GET hit existing ones.
+    struct Live
+    {
+        uint64_t orderID;
+        uint32_t product;
+        Order::Verb verb;
+    };
+    std::vector<Live> live;
+    uint64_t next_orderID = 1;
+
+    std::vector<Command> commands;
+    commands.reserve(count);
+    while (commands.size() < count)
+    {
+        auto type = static_cast<CommandType>(pick_type(random));
+        if (live.empty())
+        {
+            type = CommandType::CREATE;
+        }
+        else if (type == CommandType::CREATE && 
+          live.size() > profile.target_live_orders)
+        {
+            type = CommandType::DELETE;
+        }
+        else if (type == CommandType::DELETE && 
+          live.size() < profile.target_live_orders / 2)
+        {
+            type = CommandType::CREATE;
+        }
+
+        Command command;
+        command.type = type;
+        switch (type)
+        {
+            case CommandType::CREATE:
+            {
+                auto product = pick_product(random);
+                mid[product] += random() % 3 - 1;
+                command.verb = random() % 2 ? Order::Verb::BUY : 
+                  Order::Verb::SELL;
+                // Bids below the mid, asks above: the book doesn't cross.
+                command.price = command.verb == Order::Verb::BUY ? 
+                  mid[product] - 1 - pick_offset(random) : 
+                  mid[product] + 1 + pick_offset(random);
+                command.quantity = pick_quantity(random);
+                command.orderID = std::to_string(next_orderID);
+                command.productID = "P" + std::to_string(product);
+                live.push_back({next_orderID++, product, command.verb});
+                break;
+            }
+            case CommandType::DELETE:
+            {
+                auto index = random() % live.size();
+                command.orderID = std::to_string(live[index].orderID);
+                live[index] = live.back();
+                live.pop_back();
+                break;
+            }
+            case CommandType::MODIFY:
+            {
+                const auto& order = live[random() % live.size()];
+                command.orderID = std::to_string(order.orderID);
+                command.price = order.verb == Order::Verb::BUY ? 
+                  mid[order.product] - 1 - pick_offset(random) : 
+                  mid[order.product] + 1 + pick_offset(random);
+                command.quantity = pick_quantity(random);
+                break;
+            }
+            case CommandType::GET:
+                command.orderID = std::to_string(
+                  live[random() % live.size()].orderID);
+                break;
+            default:
+                command.productID = "P" + std::to_string(pick_product(random));
+                break;
+        }
+        commands.push_back(std::move(command));
+    }
+
+    return commands;
+}
@@ -0,0 +1,514 @@
+// Replay benchmark for the Order Book: drives it with a recorded command log 
+//  (text or binary, see bench/workload.hpp) or a synthetic one, and reports 
+//  throughput and latency percentiles per command type. Each workload runs 
+//  twice: through OrderBookParser (text in, text out, like the server) and 
+//  straight into OrderBook (commands pre-tokenized).
+// Usage:
+//  book_bench generate <profile> <count> <file> [binary]
+//  book_bench replay <file> [perf|bounded|numeric]
+//  book_bench run <profile> <count> [perf|bounded|numeric]
+// Profiles: cancel-heavy, touch-heavy, many-products.
+// 'perf' adds a third pass that reads the hardware counters (see 
+//  perf_counters.hpp) around the parse, apply and respond phases of each 
+//  command and reports them per command type.
+// 'bounded' adds a pass on a bounded-memory OrderBook (see OrderBook::Limits)
+//  that counts the heap allocations after a warm-up: the exit code is 1 if
+//  there was any.
+// 'numeric' adds the direct and bounded passes again with numeric order IDs
+//  indexed directly (see OrderBook::index_numeric_ids()): the workloads' IDs
+//  are dense numbers, like most gateways'.
+
+// C++ standard
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdlib> // For malloc(), free().
+#include <new>
+#include <unordered_set>
+// Custom
+#include "order_book.hpp"
+#include "order_book_parser.hpp"
+#include "bench/include/bench/workload.hpp"
+#include "perf_counters/include/perf_counters/perf_counters.hpp"
+
+
+constexpr size_t command_types = static_cast<size_t>(CommandType::COUNT);
+
+// Allocation counting for the bounded pass: every global operator new (and 
+//  new[], which calls it) of the process goes through here. noinline, or GCC
+//  sees malloc() paired with delete and warns.
+static std::atomic<bool> g_count_allocations{false};
+static std::atomic<size_t> g_allocations{0};
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    if (g_count_allocations.load(std::memory_order_relaxed))
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (auto memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+__attribute__((noinline)) void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+// The aligned ones too: std::pmr::new_delete_resource() goes through them.
+__attribute__((noinline)) void* operator new(size_t size, 
+  std::align_val_t alignment)
+{
+    if (g_count_allocations.load(std::memory_order_relaxed))
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto align = static_cast<size_t>(alignment);
+    if (auto memory = std::aligned_alloc(align, 
+      (std::max<size_t>(size, 1) + align - 1) / align * align))
+    {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+__attribute__((noinline)) void operator delete(void* memory, 
+  std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+__attribute__((noinline)) void operator delete(void* memory, size_t, 
+  std::align_val_t) noexcept
+{
+    std::free(memory);
+}
+
+// Latency samples in ns, one vector per command type.
+struct LatencySamples
+{
+    std::vector<uint64_t> per_type[command_types];
+
+    void reserve(size_t count)
+    {
+        for (auto& samples : per_type)
+        {
+            samples.reserve(count);
+        }
+    }
+};
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const std::string& title, LatencySamples& latencies, 
+  uint64_t wall_ns)
+{
+    std::cout << title << "\n";
+    std::cout << "  " << std::left << std::setw(16) << "command" << std::right
+      << std::setw(10) << "count" << std::setw(12) << "Mops/s" 
+      << std::setw(9) << "p50" << std::setw(9) << "p90" << std::setw(9) 
+      << "p99" << std::setw(9) << "p99.9" << std::setw(10) << "max" 
+      << "   (ns)\n";
+
+    size_t total = 0;
+    for (size_t type = 0; type < command_types; type++)
+    {
+        auto& samples = latencies.per_type[type];
+        if (samples.empty())
+        {
+            continue;
+        }
+        total += samples.size();
+
+        uint64_t busy_ns = 0;
+        for (auto sample : samples)
+        {
+            busy_ns += sample;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](double p) {
+            return samples[std::min(samples.size() - 1, 
+              static_cast<size_t>(p * samples.size()))];
+        };
+
+        std::cout << "  " << std::left << std::setw(16) 
+          << command_name(static_cast<CommandType>(type)) << std::right 
+          << std::setw(10) << samples.size() << std::setw(12) << std::fixed 
+          << std::setprecision(2) << (busy_ns ? samples.size() * 1e3 / busy_ns : 0)
+          << std::setw(9) << percentile(0.5) << std::setw(9) << percentile(0.9)
+          << std::setw(9) << percentile(0.99) << std::setw(9) 
+          << percentile(0.999) << std::setw(10) << samples.back() << "\n";
+    }
+    std::cout << "  total " << total << " commands in " << wall_ns / 1e6 
+      << " ms: " << total * 1e3 / std::max<uint64_t>(wall_ns, 1) 
+      << " Mops/s (including timing overhead)\n";
+}
+
+// What a command returned, enough to format the reply.
+struct Result
+{
+    bool ok;
+    Order order; // GET only, reused across commands.
+    uint32_t bid_quantity, bid_price, ask_quantity, ask_price; // AGGREGATED_BEST.
+};
+
+static void execute(OrderBook& book, const Command& command, Result& result)
+{
+    result.ok = false;
+    switch (command.type)
+    {
+        case CommandType::CREATE:
+            result.ok = book.create(command.orderID, command.productID, 
+              command.verb, command.price, command.quantity);
+            break;
+        case CommandType::DELETE:
+            result.ok = book.del(command.orderID);
+            break;
+        case CommandType::MODIFY:
+            result.ok = book.modify(command.orderID, command.price, 
+              command.quantity);
+            break;
+        case CommandType::GET:
+            result.ok = book.get(command.orderID, result.order);
+            break;
+        case CommandType::AGGREGATED_BEST:
+            result.ok = book.aggregated_best(command.productID, 
+              result.bid_quantity, result.bid_price, result.ask_quantity, 
+              result.ask_price);
+            break;
+        default:
+            break;
+    }
+}
+
+// Same replies as OrderBookParser.
+static void format_reply(const Command& command, const Result& result, 
+  OutputBuffer& reply)
+{
+    reply.clear();
+    if (!result.ok)
+    {
+        reply.append("ERROR");
+    }
+    else if (command.type == CommandType::GET)
+    {
+        reply.append("OK: ");
+        result.order.to_chars(reply);
+    }
+    else if (command.type == CommandType::AGGREGATED_BEST)
+    {
+        reply.append("OK: ");
+        reply.append(uint64_t{result.bid_quantity});
+        reply.append('@');
+        reply.append(uint64_t{result.bid_price});
+        reply.append('|');
+        reply.append(uint64_t{result.ask_quantity});
+        reply.append('@');
+        reply.append(uint64_t{result.ask_price});
+    }
+    else
+    {
+        reply.append("OK");
+    }
+}
+
+// Returns something derived from the result, so the call can't be dropped.
+static uint64_t apply(OrderBook& book, const Command& command, 
+  Result& result)
+{
+    execute(book, command, result);
+    if (command.type == CommandType::GET && result.ok)
+    {
+        return result.order.quantity;
+    }
+    if (command.type == CommandType::AGGREGATED_BEST && result.ok)
+    {
+        return result.bid_price + result.ask_price;
+    }
+    return result.ok;
+}
+
+static void replay_direct(const std::vector<Command>& commands, 
+  bool numeric = false)
+{
+    OrderBook book;
+    if (numeric)
+    {
+        book.index_numeric_ids();
+    }
+    LatencySamples latencies;
+    latencies.reserve(commands.size() / 2);
+
+    uint64_t sink = 0;
+    Result result;
+    auto start = now_ns();
+    for (const auto& command : commands)
+    {
+        auto before = now_ns();
+        sink += apply(book, command, result);
+        latencies.per_type[static_cast<size_t>(command.type)].push_back(
+          now_ns() - before);
+    }
+    auto wall_ns = now_ns() - start;
+
+    report(std::string{"OrderBook (direct"} + (numeric ? ", numeric IDs" : "")
+      + "), checksum " + std::to_string(sink), latencies, wall_ns);
+}
+
+// Returns the allocations seen after the warm-up.
+static size_t replay_bounded(const std::vector<Command>& commands, 
+  bool numeric = false)
+{
+    // Limits from the workload itself: every CREATE could be live at once.
+    OrderBook::Limits limits{0, 0, 4096};
+    std::unordered_set<std::string> products;
+    size_t counts[command_types] = {};
+    for (const auto& command : commands)
+    {
+        counts[static_cast<size_t>(command.type)] += 1;
+        if (command.type == CommandType::CREATE)
+        {
+            limits.max_orders += 1;
+            products.insert(command.productID);
+        }
+    }
+    limits.max_products = products.size();
+
+    OrderBook book{limits};
+    if (numeric)
+    {
+        book.index_numeric_ids();
+    }
+    LatencySamples latencies;
+    for (size_t type = 0; type < command_types; type++)
+    {
+        latencies.per_type[type].reserve(counts[type]);
+    }
+
+    // Warm-up: the first 10% of the commands, not measured.
+    uint64_t sink = 0;
+    size_t rejected = 0;
+    Result result;
+    size_t warm_up = commands.size() / 10;
+    for (size_t i = 0; i < warm_up; i++)
+    {
+        sink += apply(book, commands[i], result);
+    }
+
+    g_allocations = 0;
+    g_count_allocations = true;
+    auto start = now_ns();
+    for (size_t i = warm_up; i < commands.size(); i++)
+    {
+        const auto& command = commands[i];
+        auto before = now_ns();
+        sink += apply(book, command, result);
+        latencies.per_type[static_cast<size_t>(command.type)].push_back(
+          now_ns() - before);
+        rejected += command.type == CommandType::CREATE && !result.ok;
+    }
+    auto wall_ns = now_ns() - start;
+    g_count_allocations = false;
+    size_t allocations = g_allocations;
+
+    report("OrderBook (bounded, " + std::string{book.huge_pages() ? 
+      "huge pages" : "no huge pages"} + (numeric ? ", numeric IDs" : "") + 
+      "), checksum " + std::to_string(sink), latencies, wall_ns);
+    std::cout << "  " << allocations << " allocations after warm-up, " 
+      << rejected << " CREATE rejected\n";
+    return allocations;
+}
+
+static void replay_parser(const std::vector<Command>& commands)
+{
+    // Lines split into command and parameters up front, like the console does
+    //  before calling the parser.
+    struct Line
+    {
+        CommandType type;
+        std::string command;
+        std::string parameters;
+    };
+    std::vector<Line> lines;
+    lines.reserve(commands.size());
+    for (const auto& command : commands)
+    {
+        auto line = command.to_line();
+        auto space = line.find(' ');
+        lines.push_back({command.type, line.substr(0, space), 
+          line.substr(space + 1)});
+    }
+
+    OrderBookParser parser;
+    LatencySamples latencies;
+    latencies.reserve(commands.size() / 2);
+    // Like a connection's reply buffer.
+    char reply_data[4096];
+    OutputBuffer reply{reply_data, sizeof(reply_data)};
+
+    size_t sink = 0;
+    auto start = now_ns();
+    for (auto& line : lines)
+    {
+        auto before = now_ns();
+        reply.clear();
+        parser.dispatch(line.command, line.parameters, reply);
+        sink += reply.view().size();
+        latencies.per_type[static_cast<size_t>(line.type)].push_back(
+          now_ns() - before);
+    }
+    auto wall_ns = now_ns() - start;
+
+    report("OrderBookParser, checksum " + std::to_string(sink), latencies, 
+      wall_ns);
+}
+
+static void profile_phases(const std::vector<Command>& commands)
+{
+    // Text lines, as they'd come off the wire.
+    std::vector<std::string> lines;
+    lines.reserve(commands.size());
+    for (const auto& command : commands)
+    {
+        lines.push_back(command.to_line());
+    }
+
+    std::vector<std::string> operations;
+    for (size_t type = 0; type < command_types; type++)
+    {
+        operations.push_back(command_name(static_cast<CommandType>(type)));
+    }
+    PerfCounters counters;
+    PhaseProfile profile{operations, {"parse", "apply", "respond"}};
+
+    OrderBook book;
+    PerfCounters::Sample samples[4];
+    Command command;
+    Result result;
+    char reply_data[4096];
+    OutputBuffer reply{reply_data, sizeof(reply_data)};
+    for (const auto& line : lines)
+    {
+        counters.read(samples[0]);
+        parse_command(line, command);
+        counters.read(samples[1]);
+        execute(book, command, result);
+        counters.read(samples[2]);
+        format_reply(command, result, reply);
+        counters.read(samples[3]);
+
+        auto operation = static_cast<size_t>(command.type);
+        for (size_t phase = 0; phase < 3; phase++)
+        {
+            profile.add(operation, phase, samples[phase], samples[phase + 1]);
+        }
+        profile.count(operation);
+    }
+
+    std::cout << "Hardware counters per phase\n";
+    profile.report(std::cout, counters);
+}
+
+static const WorkloadProfile* find_profile(const std::string& name)
+{
+    for (const auto& profile : workload_profiles())
+    {
+        if (name == profile.name)
+        {
+            return &profile;
+        }
+    }
+    std::cerr << "Unknown profile: " << name << "\n";
+    return nullptr;
+}
+
+static int usage()
+{
+    std::cerr << "Usage:\n"
+      "  book_bench generate <profile> <count> <file> [binary]\n"
+      "  book_bench replay <file> [perf|bounded|numeric]\n"
+      "  book_bench run <profile> <count> [perf|bounded|numeric]\n"
+      "Profiles:";
+    for (const auto& profile : workload_profiles())
+    {
+        std::cerr << " " << profile.name;
+    }
+    std::cerr << "\n";
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        return usage();
+    }
+    std::string mode{argv[1]};
+
+    std::vector<Command> commands;
+    bool perf = std::string{argv[argc - 1]} == "perf";
+    bool bounded = std::string{argv[argc - 1]} == "bounded";
+    bool numeric = std::string{argv[argc - 1]} == "numeric";
+    if (mode == "generate" && argc >= 5)
+    {
+        auto profile = find_profile(argv[2]);
+        if (profile == nullptr)
+        {
+            return 1;
+        }
+        commands = generate_workload(*profile, std::stoull(argv[3]));
+        bool binary = argc >= 6 && std::string{argv[5]} == "binary";
+        store_workload(argv[4], commands, binary);
+        return 0;
+    }
+    else if (mode == "replay")
+    {
+        commands = load_workload(argv[2]);
+    }
+    else if (mode == "run" && argc >= 4)
+    {
+        auto profile = find_profile(argv[2]);
+        if (profile == nullptr)
+        {
+            return 1;
+        }
+        commands = generate_workload(*profile, std::stoull(argv[3]));
+    }
+    else
+    {
+        return usage();
+    }
+
+    std::cout << commands.size() << " commands\n";
+    replay_parser(commands);
+    replay_direct(commands);
+    if (perf)
+    {
+        profile_phases(commands);
+    }
+    if (bounded && replay_bounded(commands) != 0)
+    {
+        return 1;
+    }
+    if (numeric)
+    {
+        replay_direct(commands, true);
+        if (replay_bounded(commands, true) != 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,330 @@
+// Run mode with the book on a thread of its own, pinned to a core (ideally an
+//  isolated one: isolcpus, nohz_full) and never sleeping: it busy-polls its
+//  request queue instead of waiting in the kernel, so no request pays a
+//  scheduler wakeup (tens of us) or a migration to a cold core. The event
+//  loop thread keeps the network and the sessions, pinned apart. The book
+//  thread needs a core of its own, except with Idle::BACKOFF.
+// - A request is a Job owned by its session (in the coroutine frame): only
+//    its pointer goes through the two SpscRings, to the book thread and back.
+//    No allocation, no lock, no syscall on the book thread.
+// - The book is built on the book thread, once it's pinned: Linux puts a
+//    page on the NUMA node of the thread that first touches it, so the book
+//    (the bounded mode's arena, prefaulted, included) is local to its core.
+// - Expiry and checkpoints run on the book thread between jobs, no command
+//    needed. A checkpoint record is the exception to "no syscall": its 
+//    io_uring_enter(), or without io_uring its write() and fdatasync() (a
+//    disk's latency, once per ORDER_BOOK_CHECKPOINT_MS). Its compaction 
+//    runs on a thread of its own, on the I/O CPUs.
+// - The loop thread polls the completions every round and doesn't block in
+//    the kernel while jobs are in flight (see EventLoop::set_poll()).
+
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <cstring> // For strerror().
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // For _mm_pause().
+#endif
+// POSIX/Linux
+#include <pthread.h>
+#include <sched.h>
+// Custom
+#include "order_book_parser.hpp"
+#include "event_loop/include/event_loop/event_loop.hpp"
+#include "spsc_ring/include/spsc_ring/spsc_ring.hpp"
+#include "trace/include/trace/trace.hpp"
+
+
+// Pins the calling thread to 'cpus', e.g. "3" or "2,3". Threads it starts
+//  afterwards inherit the same CPUs. Throws if a CPU doesn't exist or isn't
+//  allowed (e.g. by the cgroup).
+void pin_thread(const std::string& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    size_t start = 0;
+    while (start < cpus.size())
+    {
+        auto end = cpus.find(',', start);
+        if (end == std::string::npos)
+        {
+            end = cpus.size();
+        }
+        CPU_SET(std::stoi(cpus.substr(start, end - start)), &set);
+        start = end + 1;
+    }
+    auto error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0)
+    {
+        throw std::runtime_error{"Can't pin a thread to CPU(s) " + cpus +
+          ": " + std::strerror(error)};
+    }
+}
+
+class BookThread
+{
+  public:
+    // What the book thread does when its queue is empty.
+    enum class Idle
+    {
+        SPIN, // Polls again at once: the lowest latency.
+        PAUSE, // A pause instruction per poll: frees the core's pipeline for
+               //  its hyperthread sibling, and less power, for ~0.1 us.
+        BACKOFF // Pauses doubling with the idle polls, up to max_pauses,
+                //  then a sched_yield() per poll: less traffic on the queue's
+                //  cache line when idle, and the core's other threads run
+                //  (never a sleep: a few us at most on the next request).
+    };
+    static constexpr unsigned max_pauses{64};
+
+    // One request, from the session that co_awaits submit() with it. The
+    //  strings and the reply buffer are the session's: the book thread uses
+    //  them until it hands the job back.
+    struct Job
+    {
+        const std::string* command; // nullptr: cancel_session(session).
+        std::string* parameters;
+        OutputBuffer* reply;
+        uint32_t session;
+        uint64_t request{0}; // For tracing.
+        std::coroutine_handle<> waiter{};
+    };
+
+    // Starts the thread, pins it to 'cpu', and has it build the book with
+    //  'make_book'; returns once the book is there. Throws what pinning or
+    //  'make_book' threw.
+    BookThread(EventLoop& loop, const std::string& cpu, Idle idle,
+      std::function<std::unique_ptr<OrderBookParser>()> make_book,
+      size_t queue_capacity = 4096);
+    // Stops the thread: no job may be in flight any more.
+    ~BookThread();
+    BookThread(const BookThread&) = delete;
+    BookThread& operator=(const BookThread&) = delete;
+
+    // Only from the book thread, or while no job is in flight.
+    OrderBookParser& parser()
+    {
+        return *m_parser;
+    }
+
+    // co_await submit(job): resumed on the loop thread once the book thread
+    //  has run it.
+    auto submit(Job& job)
+    {
+        struct Awaiter
+        {
+            BookThread& book_thread;
+            Job& job;
+
+            bool await_ready() const
+            {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> waiter)
+            {
+                job.waiter = waiter;
+                book_thread.push(job);
+            }
+            void await_resume() const
+            {
+            }
+        };
+        return Awaiter{*this, job};
+    }
+
+  private:
+    static constexpr size_t batch{64};
+    static constexpr size_t expire_batch{256};
+
+    EventLoop& m_loop;
+    const Idle m_idle;
+    std::unique_ptr<OrderBookParser> m_parser;
+    SpscRing<Job*> m_requests;
+    SpscRing<Job*> m_completions;
+    size_t m_in_flight{0}; // Loop thread only.
+    std::atomic<bool> m_stopping{false};
+    std::thread m_thread;
+
+    void push(Job& job);
+    // Loop thread: the completed jobs' sessions posted. True while jobs are
+    //  in flight.
+    bool poll();
+    void run();
+    void handle(Job& job);
+
+    static void pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+};
+
+BookThread::BookThread(EventLoop& loop, const std::string& cpu, Idle idle,
+  std::function<std::unique_ptr<OrderBookParser>()> make_book,
+  size_t queue_capacity)
+: m_loop{loop}, m_idle{idle}, m_requests{queue_capacity},
+  m_completions{queue_capacity}
+{
+    std::exception_ptr error;
+    std::atomic<bool> ready{false};
+    m_thread = std::thread{[&, make_book = std::move(make_book)]
+      {
+          try
+          {
+              pin_thread(cpu);
+              m_parser = make_book();
+          }
+          catch (...)
+          {
+              error = std::current_exception();
+          }
+          // No access to 'error' and 'ready' after this: they go away.
+          auto failed = error != nullptr;
+          ready.store(true, std::memory_order_release);
+          if (!failed)
+          {
+              run();
+          }
+      }};
+    while (!ready.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+    if (error)
+    {
+        m_thread.join();
+        std::rethrow_exception(error);
+    }
+
+    m_loop.set_poll([](void* context)
+      {
+          return static_cast<BookThread*>(context)->poll();
+      }, this);
+}
+
+BookThread::~BookThread()
+{
+    m_loop.set_poll(nullptr, nullptr);
+    m_stopping.store(true, std::memory_order_relaxed);
+    m_thread.join();
+}
+
+void BookThread::push(Job& job)
+{
+    // Full: the book thread may itself be waiting for room in the
+    //  completions, so those are taken meanwhile.
+    while (!m_requests.try_push(&job))
+    {
+        poll();
+        pause();
+    }
+    m_in_flight++;
+}
+
+bool BookThread::poll()
+{
+    Job* jobs[batch];
+    size_t count;
+    size_t completed = 0;
+    while ((count = m_completions.pop_batch(jobs, batch)) != 0)
+    {
+        m_in_flight -= count;
+        completed += count;
+        for (size_t i = 0; i < count; i++)
+        {
+            m_loop.post(jobs[i]->waiter);
+        }
+    }
+    // Waiting on the book thread: if it shares this core, it runs now 
+    //  rather than at the end of this thread's time slice.
+    if (completed == 0 && m_in_flight != 0)
+    {
+        std::this_thread::yield();
+    }
+    return m_in_flight != 0;
+}
+
+void BookThread::run()
+{
+    Job* jobs[batch];
+    unsigned idle_polls = 0;
+    while (!m_stopping.load(std::memory_order_relaxed))
+    {
+        // Good-till-time orders due by now, a bounded batch per poll, and a
+        //  checkpoint if one is due.
+        auto now = OrderBook::now_ns();
+        m_parser->book().expire(now, expire_batch);
+        m_parser->book().checkpoint(now);
+
+        auto count = m_requests.pop_batch(jobs, batch);
+        if (count == 0)
+        {
+            switch (m_idle)
+            {
+              case Idle::SPIN:
+                break;
+              case Idle::PAUSE:
+                pause();
+                break;
+              case Idle::BACKOFF:
+                if ((1u << idle_polls) > max_pauses)
+                {
+                    std::this_thread::yield();
+                    break;
+                }
+                for (unsigned i = 0; i < (1u << idle_polls); i++)
+                {
+                    pause();
+                }
+                idle_polls++;
+                break;
+            }
+            continue;
+        }
+        idle_polls = 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            handle(*jobs[i]);
+            while (!m_completions.try_push(jobs[i]))
+            {
+                pause();
+            }
+        }
+    }
+    // The last changes, while the book is still there.
+    m_parser->book().checkpoint(OrderBook::now_ns(), true);
+}
+
+void BookThread::handle(Job& job)
+{
+    TRACE_REQUEST(job.request);
+    if (!job.command)
+    {
+        m_parser->cancel_session(job.session);
+        return;
+    }
+    m_parser->set_session(job.session);
+    // What the book still throws (e.g. bad_alloc) fails this job only: 
+    //  uncaught, it would end the process from this thread.
+    try
+    {
+        m_parser->dispatch(*job.command, *job.parameters, *job.reply);
+    }
+    catch (const std::exception&)
+    {
+        job.reply->clear();
+        job.reply->append("ERROR");
+    }
+}
@@ -0,0 +1,832 @@
+// Incremental checkpoints of the book, for a restart that doesn't replay the
+//  whole journal. A base record has the whole book; a delta record only what
+//  changed since the record before it (the book tracks its dirty orders and
+//  levels, see OrderBook::checkpoint()): one every few seconds costs I/O in
+//  proportion to the activity, not to the size of the book.
+// A record is a CheckpointHeader, then tagged entries:
+//  - NEXT_ID id: create_auto()'s next ID;
+//  - PRODUCT index productID: a product interned since the last record;
+//  - LADDER / LADDER_WHOLE product*2+side, then LEVEL price quantity entries,
+//    ascending: levels changed (quantity 0: gone), or all of them (the side's
+//    other levels are gone);
+//  - ORDER_BUY / ORDER_SELL slot orderID product price quantity expires: an
+//    order new in its slot (expires: wall clock ms, 0 if never);
+//  - MODIFY slot price quantity: the slot's order, changed;
+//  - ERASE slot: the slot's order is gone.
+//  Numbers are varints (LEB128). Slots ascend through a record and are
+//  stored as the difference from the previous one, order prices as the
+//  (zigzag) difference from the previous order's, level prices as the
+//  difference from the previous level's: most entries are a few bytes.
+//  A header carries its payload's size and xxHash64: a torn record (crash
+//  in the middle of a write) is seen, and recovery stops there.
+// On disk, records go in numbered segments "<name>.<n>", each one appended
+//  to by one run and fdatasync'd per record. Recovery starts at the last
+//  segment that begins with a base and applies every record after it, in
+//  sequence. Once the deltas outweigh their base, compaction merges base and
+//  deltas into one new base (CheckpointImage) on a thread of its own, while
+//  new deltas go to the next segment; the new base replaces the last merged
+//  segment with a rename, the older ones are removed: a crash at any point
+//  leaves a chain that recovers to the same book.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio> // For rename().
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+// POSIX
+#include <fcntl.h>
+#include <sched.h> // For sched_getaffinity().
+#include <unistd.h> // For fsync().
+#include "../../../hash_functions/include/wallet/hash_functions.hpp" // xxHash64.
+#include "../../../io_ring/include/io_ring/io_ring.hpp"
+
+
+enum class CheckpointKind : uint8_t
+{
+    BASE = 1,
+    DELTA = 2
+};
+
+enum class CheckpointTag : uint8_t
+{
+    NEXT_ID = 1,
+    PRODUCT,
+    LADDER,
+    LADDER_WHOLE,
+    LEVEL,
+    ORDER_BUY,
+    ORDER_SELL,
+    MODIFY,
+    ERASE
+};
+
+struct CheckpointHeader
+{
+    char magic[4]; // "OBCK"
+    CheckpointKind kind;
+    uint8_t padding[3];
+    uint64_t sequence; // 1, 2, ... across bases and deltas.
+    uint64_t size; // Of the payload.
+    uint64_t checksum; // xxHash64 of the payload.
+};
+static_assert(sizeof(CheckpointHeader) == 32);
+
+inline void put_varint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+inline bool get_varint(const char*& data, const char* end, uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; data != end && shift < 64; shift += 7)
+    {
+        auto byte = static_cast<uint8_t>(*data++);
+        value |= uint64_t{byte & 0x7fu} << shift;
+        if (byte < 0x80)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+// Small differences of either sign into small unsigned numbers.
+inline uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^
+      static_cast<uint64_t>(value >> 63);
+}
+inline int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Appends one record to a string. Entries in the order documented above:
+//  the orders' slots ascending across order(), modify() and erase().
+class CheckpointEncoder
+{
+  public:
+    CheckpointEncoder(std::string& out, CheckpointKind kind,
+      uint64_t sequence);
+
+    void next_id(uint64_t id);
+    void product(uint32_t product, std::string_view productID);
+    // Then the side's levels with level(), ascending.
+    void ladder(uint32_t product, bool buy, bool whole);
+    void level(uint32_t price, uint32_t quantity);
+    void order(uint32_t slot, std::string_view orderID, uint32_t product,
+      bool buy, uint32_t price, uint32_t quantity, uint64_t expires_ms);
+    void modify(uint32_t slot, uint32_t price, uint32_t quantity);
+    void erase(uint32_t slot);
+
+    // Fills the header in. Returns the number of entries.
+    size_t finish();
+
+  private:
+    std::string& m_out;
+    size_t m_start;
+    size_t m_entries{0};
+    uint32_t m_slot{0};
+    uint32_t m_order_price{0};
+    uint32_t m_level_price{0};
+
+    void tag(CheckpointTag tag)
+    {
+        m_out += static_cast<char>(tag);
+        m_entries++;
+    }
+};
+
+// A book as the checkpoints have it: what recovery restores, and what
+//  compaction merges the records into.
+class CheckpointImage
+{
+  public:
+    struct Order
+    {
+        std::string orderID;
+        uint32_t product;
+        bool buy;
+        uint32_t price;
+        uint32_t quantity;
+        uint64_t expires_ms; // Wall clock, 0 if never.
+    };
+    struct Ladder
+    {
+        std::map<uint32_t, uint32_t> bids; // Price => quantity.
+        std::map<uint32_t, uint32_t> asks;
+    };
+
+    uint64_t sequence{0}; // Of the last record, 0 if none.
+    uint64_t next_id{1};
+    std::vector<std::string> products; // By index.
+    std::vector<Ladder> ladders; // Same index.
+    std::map<uint32_t, Order> orders; // By slot.
+
+    // Size of the complete, intact record at the start of 'data': 0 if
+    //  there's none (end of the data, or a torn or corrupt record).
+    static size_t record_size(std::string_view data);
+    // One record, as checked by record_size(). A base replaces everything, a
+    //  delta must be the next in sequence. False if it doesn't apply.
+    bool apply(std::string_view record);
+    // The whole image as one base record, at the same sequence.
+    void encode(std::string& out) const;
+};
+
+// The segments of one chain of checkpoints, see above.
+class CheckpointFile
+{
+  public:
+    // Deltas past max(base size, this) trigger a compaction.
+    static constexpr size_t min_compact_bytes{1 << 20};
+
+    // The compactor runs on the CPUs of the thread that makes this (the I/O
+    //  threads', see ORDER_BOOK_IO_CPUS), not on the book thread's core that
+    //  write()s and so starts it.
+    explicit CheckpointFile(uint64_t interval_ns = 2'000'000'000)
+    : m_interval_ns{interval_ns}
+    {
+        CPU_ZERO(&m_compactor_cpus);
+        sched_getaffinity(0, sizeof(m_compactor_cpus), &m_compactor_cpus);
+    }
+    ~CheckpointFile()
+    {
+        close();
+    }
+    CheckpointFile(const CheckpointFile&) = delete;
+    CheckpointFile& operator=(const CheckpointFile&) = delete;
+
+    // Recovers the chain of 'name' into 'image' (empty if there's none), and
+    //  opens a new segment for the records to come. False if the files can't
+    //  be read or written.
+    bool open(const std::string& name, CheckpointImage& image);
+    // Waits for a compaction in progress.
+    void close();
+
+    // 'interval_ns' since the last write().
+    bool due(uint64_t now) const
+    {
+        return now - m_last_ns >= m_interval_ns;
+    }
+    // Nothing recovered and nothing written yet: the next record is a base.
+    bool needs_base() const
+    {
+        return m_sequence == 0;
+    }
+    uint64_t next_sequence() const
+    {
+        return m_sequence + 1;
+    }
+    // One record (as a CheckpointEncoder made it), written and committed. A
+    //  delta without entries isn't written. With io_uring that's one 
+    //  io_uring_enter(), the sync completes in the background; without it 
+    //  (see JournalFile) a write() and an fdatasync() the caller waits for.
+    void write(const std::string& record, uint64_t now);
+
+  private:
+    std::string m_name;
+    uint64_t m_interval_ns;
+    uint64_t m_last_ns{0};
+    uint64_t m_sequence{0};
+    std::unique_ptr<JournalFile> m_file;
+    uint64_t m_segment{0}; // The one m_file writes.
+    uint64_t m_base_segment{0}; // The one the chain starts at.
+    size_t m_base_bytes{0};
+    size_t m_delta_bytes{0};
+    // Compaction of the segments up to m_merged_segment, in the background.
+    std::thread m_compactor;
+    cpu_set_t m_compactor_cpus;
+    std::atomic<bool> m_compacted{false};
+    uint64_t m_merged_segment{0};
+    size_t m_merged_bytes{0}; // Of the new base, set by the compactor.
+    size_t m_rotated_bytes{0}; // Deltas written since the rotation.
+
+    std::string segment_name(uint64_t segment) const
+    {
+        return m_name + "." + std::to_string(segment);
+    }
+    // Segment numbers on disk, ascending.
+    std::vector<uint64_t> segments() const;
+    bool start_segment(uint64_t segment);
+    // The segments' directory synced: a file created, renamed or removed 
+    //  there survives a crash only once its directory entry is on disk too.
+    bool sync_directory() const;
+    void finish_compaction();
+    // Compactor: the chain from 'first' to 'last' as one base in 'last'.
+    void compact(uint64_t first, uint64_t last);
+
+    static bool read_file(const std::string& filename, std::string& data);
+    // Applies the records of a segment in order. False at the first one
+    //  that's torn or doesn't apply. 'bytes': of the records applied.
+    static bool load(const std::string& data, CheckpointImage& image,
+      size_t& bytes);
+};
+
+CheckpointEncoder::CheckpointEncoder(std::string& out, CheckpointKind kind,
+  uint64_t sequence)
+: m_out{out}, m_start{out.size()}
+{
+    CheckpointHeader header{};
+    std::memcpy(header.magic, "OBCK", 4);
+    header.kind = kind;
+    header.sequence = sequence;
+    m_out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+void CheckpointEncoder::next_id(uint64_t id)
+{
+    tag(CheckpointTag::NEXT_ID);
+    put_varint(m_out, id);
+}
+
+void CheckpointEncoder::product(uint32_t product, std::string_view productID)
+{
+    tag(CheckpointTag::PRODUCT);
+    put_varint(m_out, product);
+    put_varint(m_out, productID.size());
+    m_out += productID;
+}
+
+void CheckpointEncoder::ladder(uint32_t product, bool buy, bool whole)
+{
+    tag(whole ? CheckpointTag::LADDER_WHOLE : CheckpointTag::LADDER);
+    put_varint(m_out, uint64_t{product} * 2 + (buy ? 0 : 1));
+    m_level_price = 0;
+}
+
+void CheckpointEncoder::level(uint32_t price, uint32_t quantity)
+{
+    tag(CheckpointTag::LEVEL);
+    put_varint(m_out, price - m_level_price);
+    put_varint(m_out, quantity);
+    m_level_price = price;
+}
+
+void CheckpointEncoder::order(uint32_t slot, std::string_view orderID,
+  uint32_t product, bool buy, uint32_t price, uint32_t quantity,
+  uint64_t expires_ms)
+{
+    tag(buy ? CheckpointTag::ORDER_BUY : CheckpointTag::ORDER_SELL);
+    put_varint(m_out, slot - m_slot);
+    put_varint(m_out, orderID.size());
+    m_out += orderID;
+    put_varint(m_out, product);
+    put_varint(m_out, zigzag(int64_t{price} - m_order_price));
+    put_varint(m_out, quantity);
+    put_varint(m_out, expires_ms);
+    m_slot = slot;
+    m_order_price = price;
+}
+
+void CheckpointEncoder::modify(uint32_t slot, uint32_t price,
+  uint32_t quantity)
+{
+    tag(CheckpointTag::MODIFY);
+    put_varint(m_out, slot - m_slot);
+    put_varint(m_out, zigzag(int64_t{price} - m_order_price));
+    put_varint(m_out, quantity);
+    m_slot = slot;
+    m_order_price = price;
+}
+
+void CheckpointEncoder::erase(uint32_t slot)
+{
+    tag(CheckpointTag::ERASE);
+    put_varint(m_out, slot - m_slot);
+    m_slot = slot;
+}
+
+size_t CheckpointEncoder::finish()
+{
+    CheckpointHeader header;
+    std::memcpy(&header, m_out.data() + m_start, sizeof(header));
+    const auto* payload = m_out.data() + m_start + sizeof(header);
+    header.size = m_out.size() - m_start - sizeof(header);
+    header.checksum = xxHash64::hash(payload, header.size);
+    std::memcpy(m_out.data() + m_start, &header, sizeof(header));
+    return m_entries;
+}
+
+size_t CheckpointImage::record_size(std::string_view data)
+{
+    CheckpointHeader header;
+    if (data.size() < sizeof(header))
+    {
+        return 0;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, "OBCK", 4) != 0 ||
+      header.size > data.size() - sizeof(header) ||
+      xxHash64::hash(data.data() + sizeof(header), header.size) !=
+      header.checksum)
+    {
+        return 0;
+    }
+    return sizeof(header) + header.size;
+}
+
+bool CheckpointImage::apply(std::string_view record)
+{
+    CheckpointHeader header;
+    std::memcpy(&header, record.data(), sizeof(header));
+    if (header.kind == CheckpointKind::BASE)
+    {
+        *this = CheckpointImage{};
+    }
+    else if (header.kind != CheckpointKind::DELTA ||
+      header.sequence != sequence + 1)
+    {
+        return false;
+    }
+    sequence = header.sequence;
+
+    const char* data = record.data() + sizeof(header);
+    const char* end = record.data() + record.size();
+    uint64_t slot = 0, order_price = 0, level_price = 0;
+    std::map<uint32_t, uint32_t>* levels = nullptr;
+    while (data != end)
+    {
+        auto tag = static_cast<CheckpointTag>(*data++);
+        uint64_t a, b, c, d, e;
+        switch (tag)
+        {
+          case CheckpointTag::NEXT_ID:
+            if (!get_varint(data, end, next_id))
+            {
+                return false;
+            }
+            break;
+          case CheckpointTag::PRODUCT:
+            if (!get_varint(data, end, a) || !get_varint(data, end, b) ||
+              b > uint64_t(end - data))
+            {
+                return false;
+            }
+            if (a >= products.size())
+            {
+                products.resize(a + 1);
+                ladders.resize(a + 1);
+            }
+            products[a].assign(data, b);
+            data += b;
+            break;
+          case CheckpointTag::LADDER:
+          case CheckpointTag::LADDER_WHOLE:
+            if (!get_varint(data, end, a) || a / 2 >= ladders.size())
+            {
+                return false;
+            }
+            levels = a % 2 == 0 ? &ladders[a / 2].bids : &ladders[a / 2].asks;
+            if (tag == CheckpointTag::LADDER_WHOLE)
+            {
+                levels->clear();
+            }
+            level_price = 0;
+            break;
+          case CheckpointTag::LEVEL:
+            if (levels == nullptr || !get_varint(data, end, a) ||
+              !get_varint(data, end, b))
+            {
+                return false;
+            }
+            level_price += a;
+            if (b == 0)
+            {
+                levels->erase(level_price);
+            }
+            else
+            {
+                (*levels)[level_price] = b;
+            }
+            break;
+          case CheckpointTag::ORDER_BUY:
+          case CheckpointTag::ORDER_SELL:
+          {
+            if (!get_varint(data, end, a) || !get_varint(data, end, b) ||
+              b > uint64_t(end - data))
+            {
+                return false;
+            }
+            slot += a;
+            // A base's slots all ascend: appended at the end, no search.
+            auto& order = !orders.empty() && orders.rbegin()->first < slot ?
+              orders.emplace_hint(orders.end(), slot, Order{})->second :
+              orders[slot];
+            order.orderID.assign(data, b);
+            data += b;
+            if (!get_varint(data, end, c) || !get_varint(data, end, d) ||
+              !get_varint(data, end, e) || c >= products.size())
+            {
+                return false;
+            }
+            order.product = c;
+            order.buy = tag == CheckpointTag::ORDER_BUY;
+            order_price += unzigzag(d);
+            order.price = order_price;
+            order.quantity = e;
+            if (!get_varint(data, end, order.expires_ms))
+            {
+                return false;
+            }
+            break;
+          }
+          case CheckpointTag::MODIFY:
+          {
+            if (!get_varint(data, end, a) || !get_varint(data, end, b) ||
+              !get_varint(data, end, c))
+            {
+                return false;
+            }
+            slot += a;
+            auto it = orders.find(slot);
+            if (it == orders.end())
+            {
+                return false;
+            }
+            order_price += unzigzag(b);
+            it->second.price = order_price;
+            it->second.quantity = c;
+            break;
+          }
+          case CheckpointTag::ERASE:
+            if (!get_varint(data, end, a) || orders.erase(slot += a) == 0)
+            {
+                return false;
+            }
+            break;
+          default:
+            return false;
+        }
+    }
+    return true;
+}
+
+void CheckpointImage::encode(std::string& out) const
+{
+    CheckpointEncoder encoder{out, CheckpointKind::BASE, sequence};
+    encoder.next_id(next_id);
+    for (size_t i = 0; i < products.size(); i++)
+    {
+        encoder.product(i, products[i]);
+    }
+    for (size_t i = 0; i < ladders.size(); i++)
+    {
+        for (auto buy : {true, false})
+        {
+            const auto& levels = buy ? ladders[i].bids : ladders[i].asks;
+            if (levels.empty())
+            {
+                continue;
+            }
+            encoder.ladder(i, buy, true);
+            for (const auto& [price, quantity] : levels)
+            {
+                encoder.level(price, quantity);
+            }
+        }
+    }
+    for (const auto& [slot, order] : orders)
+    {
+        encoder.order(slot, order.orderID, order.product, order.buy,
+          order.price, order.quantity, order.expires_ms);
+    }
+    encoder.finish();
+}
+
+bool CheckpointFile::read_file(const std::string& filename, std::string& data)
+{
+    std::ifstream file{filename, std::ios::binary};
+    if (!file)
+    {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>{file}, {});
+    return !file.bad();
+}
+
+bool CheckpointFile::load(const std::string& data, CheckpointImage& image,
+  size_t& bytes)
+{
+    bytes = 0;
+    std::string_view rest{data};
+    while (!rest.empty())
+    {
+        auto size = CheckpointImage::record_size(rest);
+        if (size == 0 || !image.apply(rest.substr(0, size)))
+        {
+            return false;
+        }
+        bytes += size;
+        rest.remove_prefix(size);
+    }
+    return true;
+}
+
+std::vector<uint64_t> CheckpointFile::segments() const
+{
+    namespace fs = std::filesystem;
+    const fs::path path{m_name};
+    const auto prefix = path.filename().string() + ".";
+    auto directory = path.parent_path();
+    if (directory.empty())
+    {
+        directory = ".";
+    }
+
+    std::vector<uint64_t> numbers;
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator{directory, error})
+    {
+        auto filename = entry.path().filename().string();
+        if (filename.size() <= prefix.size() ||
+          filename.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        auto suffix = std::string_view{filename}.substr(prefix.size());
+        if (suffix.size() > 19 || suffix.find_first_not_of("0123456789") !=
+          std::string_view::npos)
+        {
+            continue;
+        }
+        numbers.push_back(std::stoull(std::string{suffix}));
+    }
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+bool CheckpointFile::open(const std::string& name, CheckpointImage& image)
+{
+    m_name = name;
+    image = CheckpointImage{};
+    auto numbers = segments();
+
+    // The last segment that starts with an intact base.
+    size_t first = numbers.size();
+    std::string data;
+    for (size_t i = numbers.size(); i-- > 0; )
+    {
+        if (!read_file(segment_name(numbers[i]), data))
+        {
+            return false;
+        }
+        CheckpointHeader header;
+        if (CheckpointImage::record_size(data) != 0 &&
+          (std::memcpy(&header, data.data(), sizeof(header)),
+          header.kind == CheckpointKind::BASE))
+        {
+            first = i;
+            break;
+        }
+    }
+
+    // Then every record in sequence, up to the first one torn or out of
+    //  sequence. What comes after it is of no use: cut off, and the later
+    //  segments removed, like those before the base, so that the new
+    //  records follow on from the last one applied.
+    size_t last = first;
+    for (size_t i = first; i < numbers.size(); i++, last = i)
+    {
+        size_t bytes;
+        if (!read_file(segment_name(numbers[i]), data))
+        {
+            return false;
+        }
+        auto intact = load(data, image, bytes);
+        if (data.empty() && i != first)
+        {
+            // A run that wrote nothing.
+            std::remove(segment_name(numbers[i]).c_str());
+        }
+        if (i == first)
+        {
+            m_base_bytes = CheckpointImage::record_size(data);
+            m_delta_bytes = bytes - m_base_bytes;
+        }
+        else
+        {
+            m_delta_bytes += bytes;
+        }
+        if (!intact)
+        {
+            std::error_code error;
+            std::filesystem::resize_file(segment_name(numbers[i]), bytes,
+              error);
+            if (error)
+            {
+                return false;
+            }
+            last = i + 1;
+            break;
+        }
+    }
+    for (size_t i = 0; i < numbers.size(); i++)
+    {
+        if (i < first || i >= last)
+        {
+            std::remove(segment_name(numbers[i]).c_str());
+        }
+    }
+
+    m_sequence = image.sequence;
+    m_base_segment = first < numbers.size() ? numbers[first] : 0;
+    return start_segment(numbers.empty() ? 1 : numbers.back() + 1);
+}
+
+bool CheckpointFile::start_segment(uint64_t segment)
+{
+    m_file = std::make_unique<JournalFile>();
+    m_segment = segment;
+    return m_file->open(segment_name(segment), true) && sync_directory();
+}
+
+bool CheckpointFile::sync_directory() const
+{
+    auto directory = std::filesystem::path{m_name}.parent_path();
+    auto fd = ::open(directory.empty() ? "." : directory.c_str(), 
+      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    auto synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+void CheckpointFile::close()
+{
+    if (m_compactor.joinable())
+    {
+        m_compactor.join();
+        finish_compaction();
+    }
+    m_file.reset();
+}
+
+void CheckpointFile::write(const std::string& record, uint64_t now)
+{
+    m_last_ns = now;
+    CheckpointHeader header;
+    std::memcpy(&header, record.data(), sizeof(header));
+    if (header.kind == CheckpointKind::DELTA && header.size == 0)
+    {
+        return;
+    }
+    if (m_compactor.joinable() && m_compacted.load(std::memory_order_acquire))
+    {
+        m_compactor.join();
+        finish_compaction();
+    }
+
+    m_file->write(record.data(), record.size());
+    m_file->commit();
+    m_sequence = header.sequence;
+    if (header.kind == CheckpointKind::BASE)
+    {
+        m_base_segment = m_segment;
+        m_base_bytes = record.size();
+        m_delta_bytes = 0;
+        return;
+    }
+    m_delta_bytes += record.size();
+    m_rotated_bytes += record.size();
+
+    // Deltas that weigh more than their base: merged in the background, up
+    //  to this segment, while the next one takes the new deltas.
+    if (!m_compactor.joinable() &&
+      m_delta_bytes > std::max(m_base_bytes, min_compact_bytes))
+    {
+        m_file->close();
+        m_merged_segment = m_segment;
+        m_rotated_bytes = 0;
+        m_compacted.store(false, std::memory_order_relaxed);
+        m_compactor = std::thread{&CheckpointFile::compact, this,
+          m_base_segment, m_segment};
+        start_segment(m_segment + 1);
+    }
+}
+
+void CheckpointFile::finish_compaction()
+{
+    if (m_merged_bytes == 0)
+    {
+        // Failed: the old chain is still there, whole.
+        return;
+    }
+    m_base_segment = m_merged_segment;
+    m_base_bytes = m_merged_bytes;
+    m_delta_bytes = m_rotated_bytes;
+}
+
+void CheckpointFile::compact(uint64_t first, uint64_t last)
+{
+    if (CPU_COUNT(&m_compactor_cpus) != 0)
+    {
+        sched_setaffinity(0, sizeof(m_compactor_cpus), &m_compactor_cpus);
+    }
+    m_merged_bytes = 0;
+    CheckpointImage image;
+    std::string data;
+    for (auto segment = first; segment <= last; segment++)
+    {
+        size_t bytes;
+        if (std::filesystem::exists(segment_name(segment)) &&
+          (!read_file(segment_name(segment), data) ||
+          !load(data, image, bytes)))
+        {
+            m_compacted.store(true, std::memory_order_release);
+            return;
+        }
+    }
+
+    // Written aside, synced, then renamed over the last segment: that
+    //  segment is either the old one or the merged one, never half of it.
+    data.clear();
+    image.encode(data);
+    const auto temporary = segment_name(last) + ".tmp";
+    {
+        JournalFile file;
+        if (!file.open(temporary, true, false))
+        {
+            m_compacted.store(true, std::memory_order_release);
+            return;
+        }
+        file.write(data.data(), data.size());
+    }
+    if (std::rename(temporary.c_str(), segment_name(last).c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        m_compacted.store(true, std::memory_order_release);
+        return;
+    }
+    // The rename on disk before the older segments go: until then, after a
+    //  crash the last segment may still be the old one, which needs them.
+    if (!sync_directory())
+    {
+        m_compacted.store(true, std::memory_order_release);
+        return;
+    }
+    for (auto segment = first; segment < last; segment++)
+    {
+        std::remove(segment_name(segment).c_str());
+    }
+    m_merged_bytes = data.size();
+    m_compacted.store(true, std::memory_order_release);
+}
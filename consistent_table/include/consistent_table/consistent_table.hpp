@@ -1,7 +1,12 @@
+#pragma once
+
 #include <map>
 #include <string>
-#include <fstream> // For both ofstream and ifstream.
+#include <vector>
+#include <fstream> // For ifstream.
 #include <sstream>
+#include "../../../hash_functions/include/wallet/hash_functions.hpp" // xxHash64.
+#include "../../../io_ring/include/io_ring/io_ring.hpp" // JournalFile.
 
 
 class ConsistentTable
@@ -15,23 +20,29 @@ class ConsistentTable
 
 void ConsistentTable::store(const std::string& filename)
 {
-    std::ofstream file{filename};
-
-    // Error opening.
-    if (!file)
+    // One write and one fdatasync for the whole snapshot (io_uring if 
+    //  available): on disk when store() returns.
+    JournalFile file;
+    if (!file.open(filename, true))
     {
+        // Error opening.
         return;
     }
 
     // Headers.
 
     // Column names.
-    file << "orderID,productID\n";
+    std::string csv{"orderID,productID\n"};
 
     for(auto it = m_table.begin(); it != m_table.end(); it++)
     {
-        file << it->first << "," << it->second << "\n";
+        csv += std::to_string(it->first);
+        csv += ',';
+        csv += std::to_string(it->second);
+        csv += '\n';
     }
+    file.write(csv.data(), csv.size());
+    file.close();
 
     // Generated CSV file can be used to create a table in SQLite or MySQL.
 }
@@ -62,3 +73,121 @@ void ConsistentTable::load(const std::string& filename)
         m_table[stoi(productID)] = stoi(orderID);
     }
 }
+
+
+// Consistent Hashing ring: maps productIDs to shards (threads or processes).
+//  Each shard owns many points (virtual nodes) on a 64-bit ring and a product 
+//  belongs to the first point clockwise from its hash. Adding or removing a 
+//  shard only moves the products between its points and their predecessors, 
+//  ~1/N of them, instead of reshuffling everything like hash % N.
+// The hashes use fixed seeds: every process must build the same ring.
+// Only the routing table: the router that forwards commands by it and runs 
+//  the handoffs (see consistent_table.md) is left to the deployment.
+class ConsistentRing
+{
+  public:
+    // More virtual nodes, more even load per shard but a bigger ring.
+    explicit ConsistentRing(unsigned virtual_nodes = 128);
+
+    void add_shard(int shard);
+    void remove_shard(int shard);
+    int shard_of(const std::string& productID) const; // -1 if no shards.
+    bool empty() const;
+
+    struct Move
+    {
+        std::string productID;
+        int from;
+        int to;
+    };
+    // Products that change shard going from this ring to 'next': the list of 
+    //  handoffs to run (see consistent_table.md) before switching rings.
+    std::vector<Move> moves_to(const ConsistentRing& next, 
+      const std::vector<std::string>& productIDs) const;
+
+  private:
+    static constexpr uint64_t point_seed{0x2545F4914F6CDD1DULL};
+    static constexpr uint64_t product_seed{0};
+
+    std::map<uint64_t, int> m_ring; // Point on the ring => shard.
+    unsigned m_virtual_nodes;
+
+    uint64_t point(int shard, unsigned replica) const;
+};
+
+ConsistentRing::ConsistentRing(unsigned virtual_nodes)
+: m_virtual_nodes{virtual_nodes}
+{}
+
+uint64_t ConsistentRing::point(int shard, unsigned replica) const
+{
+    const uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(shard)) 
+      << 32) | replica;
+    return xxHash64::hash(key, point_seed);
+}
+
+void ConsistentRing::add_shard(int shard)
+{
+    for (unsigned replica = 0; replica < m_virtual_nodes; replica++)
+    {
+        // On the (unlikely) collision of two points the lowest shard keeps it,
+        //  so the result doesn't depend on the order shards were added.
+        auto [it, inserted] = m_ring.emplace(point(shard, replica), shard);
+        if (!inserted && shard < it->second)
+        {
+            it->second = shard;
+        }
+    }
+}
+
+void ConsistentRing::remove_shard(int shard)
+{
+    for (auto it = m_ring.begin(); it != m_ring.end();)
+    {
+        if (it->second == shard)
+        {
+            it = m_ring.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+int ConsistentRing::shard_of(const std::string& productID) const
+{
+    if (m_ring.empty())
+    {
+        return -1;
+    }
+
+    // First point clockwise, wrapping around past the last one.
+    auto it = m_ring.lower_bound(xxHash64::hash(productID, product_seed));
+    if (it == m_ring.end())
+    {
+        it = m_ring.begin();
+    }
+    return it->second;
+}
+
+bool ConsistentRing::empty() const
+{
+    return m_ring.empty();
+}
+
+std::vector<ConsistentRing::Move> ConsistentRing::moves_to(
+  const ConsistentRing& next, const std::vector<std::string>& productIDs) const
+{
+    std::vector<Move> moves;
+    for (const auto& productID : productIDs)
+    {
+        auto from = shard_of(productID);
+        auto to = next.shard_of(productID);
+        if (from != to)
+        {
+            moves.push_back({productID, from, to});
+        }
+    }
+    return moves;
+}
@@ -0,0 +1,918 @@
+// Single-threaded coroutine runtime on epoll, for the front end. Every client
+//  session (a TCP connection, or the console on stdin/stdout) is a coroutine
+//  that co_awaits its reads and writes: one thread serves all of them, and
+//  switching session at a co_await is a function return and a resume, not a
+//  kernel context switch.
+// - Task: a detached coroutine, started at once, freeing itself at the end.
+// - EventLoop: io_uring when the kernel has it, epoll otherwise. With
+//    io_uring the sessions' reads, writes and accepts are queued as SQEs and
+//    the loop submits all of them and waits for the next completions in one
+//    syscall per round: under load, a small fraction of a syscall per
+//    command. With epoll, when a watched fd is ready the loop retries the
+//    I/O its coroutine is waiting for and resumes it once the I/O is done.
+// - AsyncStream: line-buffered input and buffered output over a pair of fds,
+//    the same code for a socket and for stdin/stdout.
+// - Listener: a listening socket (TCP or Unix), co_await accept().
+// - Timer: a periodic timerfd, co_await tick(): work that can't wait for a
+//    client's command (e.g. order expiry on an idle server).
+// With epoll, I/O is tried first and waited for only if it would block: a 
+//  busy session gets no epoll round trip per command. Fds epoll refuses 
+//  (regular files, e.g. stdin redirected from a file) are always ready: I/O
+//  on them doesn't wait anyway.
+
+#pragma once
+
+#include <coroutine>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility> // For exchange().
+#include <vector>
+// POSIX/Linux
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+// Custom
+#include "../../../io_ring/include/io_ring/io_ring.hpp"
+
+
+// Fire and forget: the caller gets nothing to await, the frame goes away when
+//  the coroutine returns.
+struct Task
+{
+    struct promise_type
+    {
+        Task get_return_object()
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void()
+        {
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+class EventLoop
+{
+  public:
+    // An fd and the coroutine waiting on it, at most one at a time. Its
+    //  address goes to the kernel (epoll data, SQE user data): it must not 
+    //  move while added.
+    struct Watch
+    {
+        int fd{-1};
+        bool polled{false}; // False if epoll refused the fd: always ready.
+        IoRing* ring{nullptr}; // io_uring backend.
+        std::coroutine_handle<> waiter;
+        // The waiter's pending I/O (see IoAwaiter). epoll: retried when the 
+        //  fd is ready, true when done (the waiter is resumed), false if it 
+        //  would still block. io_uring: prepares the SQE, then takes its 
+        //  result, true when done, false to queue it again (e.g. the rest of
+        //  a short write).
+        void* operation{nullptr};
+        bool (*retry)(void* operation){nullptr};
+        void (*prepare)(void* operation, io_uring_sqe& sqe){nullptr};
+        bool (*complete)(void* operation, int result){nullptr};
+
+        template <typename Operation>
+        void wait(std::coroutine_handle<> handle, Operation& io)
+        {
+            waiter = handle;
+            operation = &io;
+            retry = [](void* operation)
+              {
+                  return static_cast<Operation*>(operation)->attempt();
+              };
+            prepare = [](void* operation, io_uring_sqe& sqe)
+              {
+                  static_cast<Operation*>(operation)->prepare(sqe);
+              };
+            complete = [](void* operation, int result)
+              {
+                  return static_cast<Operation*>(operation)->complete(result);
+              };
+            if (ring)
+            {
+                queue();
+            }
+        }
+        // io_uring: the pending operation's SQE, submitted with the next 
+        //  round.
+        void queue()
+        {
+            auto& sqe = ring->sqe();
+            prepare(operation, sqe);
+            sqe.user_data = reinterpret_cast<uint64_t>(this);
+        }
+    };
+
+    // epoll only if 'try_io_uring' is false or io_uring isn't available.
+    explicit EventLoop(bool try_io_uring = true);
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool io_uring() const
+    {
+        return m_ring != nullptr;
+    }
+
+    // epoll: non-blocking fds are edge-triggered (their I/O is retried until
+    //  it would block, so no edge is missed), for reads and writes. Blocking 
+    //  fds are level-triggered, for reads only: read once per readiness.
+    // io_uring: nothing to register, the fd goes with each SQE.
+    void add(Watch& watch, int fd, bool nonblocking);
+    void remove(Watch& watch);
+
+    // Until stop(), which may come first: a session that never had to wait
+    //  ran to its end before run().
+    void run();
+    void stop()
+    {
+        m_stopped = true;
+    }
+    // Resumes 'waiter' once the current round of I/O is handled: one 
+    //  session wakes another without running it in the middle of its own 
+    //  work.
+    void post(std::coroutine_handle<> waiter)
+    {
+        m_posted.push_back(waiter);
+    }
+    // 'poll' runs at the start of every round, e.g. to post() the sessions 
+    //  whose work another thread finished. While it returns true (work still
+    //  out there) the rounds don't block in the kernel. nullptr: none.
+    void set_poll(bool (*poll)(void* context), void* context)
+    {
+        m_poll = poll;
+        m_poll_context = context;
+    }
+
+  private:
+    static constexpr int max_events{256};
+    // SQEs queued per round before a submit is forced; the completion ring 
+    //  has twice as many entries.
+    static constexpr unsigned ring_entries{4096};
+
+    int m_epoll_fd{-1};
+    std::unique_ptr<IoRing> m_ring;
+    bool m_stopped{false};
+    std::vector<std::coroutine_handle<>> m_posted;
+    std::vector<std::coroutine_handle<>> m_resuming;
+    bool (*m_poll)(void* context){nullptr};
+    void* m_poll_context{nullptr};
+
+    void run_epoll();
+    void run_io_uring();
+    void resume_posted();
+    // Whether this round may block: nothing posted, nothing polled for.
+    bool idle()
+    {
+        auto busy = m_poll && m_poll(m_poll_context);
+        return !busy && m_posted.empty();
+    }
+};
+
+// 'Operation' has, for epoll, a bool attempt(), false if the I/O would block
+//  (tried before suspending, then on every readiness of the fd); for 
+//  io_uring, prepare(sqe) and complete(result) (see Watch); for both, 
+//  skip(), true if there's no I/O to do, and a result().
+template <typename Operation>
+struct IoAwaiter
+{
+    EventLoop::Watch& watch;
+    Operation operation;
+    bool try_first; // False for blocking fds: wait for readiness first.
+
+    bool await_ready()
+    {
+        if (operation.skip())
+        {
+            return true;
+        }
+        // io_uring: always through the ring, no syscall here.
+        return !watch.ring && (try_first || !watch.polled) && 
+          operation.attempt();
+    }
+    void await_suspend(std::coroutine_handle<> waiter)
+    {
+        watch.wait(waiter, operation);
+    }
+    auto await_resume()
+    {
+        return operation.result();
+    }
+};
+
+class AsyncStream
+{
+  public:
+    // A socket (in_fd == out_fd): closed by the destructor. Otherwise, e.g.
+    //  the console's 0 and 1: left open, and as they are (blocking or not).
+    AsyncStream(EventLoop& loop, int in_fd, int out_fd);
+    ~AsyncStream();
+    AsyncStream(const AsyncStream&) = delete;
+    AsyncStream& operator=(const AsyncStream&) = delete;
+
+    // Next line already read, without its "\n" or "\r\n". False if there's
+    //  no complete line yet (at the end of input: the unterminated rest).
+    bool getline(std::string& line);
+
+    // co_await read(): more input; false at the end of input or on error.
+    auto read()
+    {
+        return IoAwaiter<Read>{m_watch, Read{this}, m_nonblocking};
+    }
+
+    // Buffered, until flush().
+    void write(std::string_view data)
+    {
+        m_output.append(data);
+    }
+    // co_await flush(): all the buffered output; false if the peer is gone.
+    auto flush()
+    {
+        return IoAwaiter<Flush>{m_watch, Flush{this}, true};
+    }
+
+  private:
+    // Bytes per read(). A line can't be longer than max_input.
+    static constexpr size_t read_chunk{4096};
+    static constexpr size_t max_input{1 << 20};
+
+    struct Read
+    {
+        AsyncStream* stream;
+        bool done{false};
+
+        bool skip()
+        {
+            return false;
+        }
+        bool attempt();
+        void prepare(io_uring_sqe& sqe);
+        bool complete(int result);
+        bool result() const
+        {
+            return done;
+        }
+    };
+    struct Flush
+    {
+        AsyncStream* stream;
+        bool done{false};
+
+        // Nothing buffered: done, no syscall.
+        bool skip()
+        {
+            done = true;
+            return stream->m_output.empty();
+        }
+        bool attempt();
+        void prepare(io_uring_sqe& sqe);
+        bool complete(int result);
+        bool result() const
+        {
+            return done;
+        }
+    };
+
+    EventLoop& m_loop;
+    int m_in_fd;
+    int m_out_fd;
+    bool m_socket;
+    bool m_nonblocking;
+    bool m_eof{false};
+    EventLoop::Watch m_watch;
+    std::string m_input;
+    size_t m_consumed{0}; // Input already returned by getline().
+    char m_chunk[read_chunk]; // Read into, then appended to m_input.
+    std::string m_output;
+    size_t m_written{0}; // Output already written, if a flush() waited.
+};
+
+// Local addresses, for clients and for replication.
+socklen_t socket_address(const std::string& address, bool listening,
+  sockaddr_storage& storage);
+// A connected socket, ready for an AsyncStream on 'loop'; -1 on error.
+int connect_local(EventLoop& loop, const std::string& address);
+
+class Listener
+{
+  public:
+    // 'address': see socket_address(). Throws if it can't be had.
+    Listener(EventLoop& loop, const std::string& address, int backlog);
+    ~Listener();
+    Listener(const Listener&) = delete;
+    Listener& operator=(const Listener&) = delete;
+
+    // co_await accept(): the next client's fd, non-blocking with epoll (and
+    //  blocking with io_uring, which does the waiting); -1 on error.
+    auto accept()
+    {
+        return IoAwaiter<Accept>{m_watch, Accept{m_fd}, true};
+    }
+
+  private:
+    struct Accept
+    {
+        int listen_fd;
+        int fd{-1};
+
+        bool skip()
+        {
+            return false;
+        }
+        bool attempt();
+        void prepare(io_uring_sqe& sqe);
+        bool complete(int result);
+        int result() const
+        {
+            return fd;
+        }
+    };
+
+    EventLoop& m_loop;
+    int m_fd;
+    EventLoop::Watch m_watch;
+};
+
+class Timer
+{
+  public:
+    // Every 'period_ns' from now on. Throws if the timerfd can't be had.
+    Timer(EventLoop& loop, uint64_t period_ns);
+    ~Timer();
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    // co_await tick(): the next period is over (the ones missed meanwhile 
+    //  count as one); false on error.
+    auto tick()
+    {
+        return IoAwaiter<Tick>{m_watch, Tick{m_fd}, true};
+    }
+
+  private:
+    struct Tick
+    {
+        int fd;
+        uint64_t expirations{0}; // Read into: periods over since the last.
+        bool done{false};
+
+        bool skip()
+        {
+            return false;
+        }
+        bool attempt();
+        void prepare(io_uring_sqe& sqe);
+        bool complete(int result);
+        bool result() const
+        {
+            return done;
+        }
+    };
+
+    EventLoop& m_loop;
+    int m_fd;
+    EventLoop::Watch m_watch;
+};
+
+Timer::Timer(EventLoop& loop, uint64_t period_ns)
+: m_loop{loop}
+{
+    m_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | 
+      (loop.io_uring() ? 0 : TFD_NONBLOCK));
+    itimerspec spec{};
+    spec.it_interval.tv_sec = period_ns / 1'000'000'000;
+    spec.it_interval.tv_nsec = period_ns % 1'000'000'000;
+    spec.it_value = spec.it_interval;
+    if (m_fd < 0 || timerfd_settime(m_fd, 0, &spec, nullptr) < 0)
+    {
+        auto error = errno;
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+        throw std::runtime_error{std::string{"Can't start a timer: "} + 
+          std::strerror(error)};
+    }
+    m_loop.add(m_watch, m_fd, !m_loop.io_uring());
+}
+
+Timer::~Timer()
+{
+    m_loop.remove(m_watch);
+    close(m_fd);
+}
+
+bool Timer::Tick::attempt()
+{
+    while (true)
+    {
+        auto count = ::read(fd, &expirations, sizeof(expirations));
+        if (count == sizeof(expirations))
+        {
+            done = true;
+            return true;
+        }
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return false;
+        }
+        done = false;
+        return true;
+    }
+}
+
+void Timer::Tick::prepare(io_uring_sqe& sqe)
+{
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(&expirations);
+    sqe.len = sizeof(expirations);
+    sqe.off = uint64_t(-1);
+}
+
+// 'result': bytes read, or -errno.
+bool Timer::Tick::complete(int result)
+{
+    if (result == -EINTR || result == -EAGAIN)
+    {
+        return false;
+    }
+    done = result == sizeof(expirations);
+    return true;
+}
+
+EventLoop::EventLoop(bool try_io_uring)
+{
+    if (try_io_uring)
+    {
+        m_ring = std::make_unique<IoRing>(ring_entries);
+        if (m_ring->available())
+        {
+            return;
+        }
+        m_ring.reset();
+    }
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd < 0)
+    {
+        throw std::runtime_error{std::string{"epoll_create1() failed: "} +
+          std::strerror(errno)};
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    if (m_epoll_fd >= 0)
+    {
+        close(m_epoll_fd);
+    }
+}
+
+void EventLoop::add(Watch& watch, int fd, bool nonblocking)
+{
+    watch.fd = fd;
+    if (m_ring)
+    {
+        watch.ring = m_ring.get();
+        return;
+    }
+
+    epoll_event event{};
+    event.events = nonblocking ? EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET :
+      EPOLLIN;
+    event.data.ptr = &watch;
+    watch.polled = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    // EPERM: a regular file, always ready.
+    if (!watch.polled && errno != EPERM)
+    {
+        throw std::runtime_error{std::string{"epoll_ctl() failed: "} +
+          std::strerror(errno)};
+    }
+}
+
+void EventLoop::remove(Watch& watch)
+{
+    if (watch.polled)
+    {
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, watch.fd, nullptr);
+        watch.polled = false;
+    }
+}
+
+void EventLoop::run()
+{
+    if (m_ring)
+    {
+        run_io_uring();
+    }
+    else
+    {
+        run_epoll();
+    }
+}
+
+void EventLoop::run_epoll()
+{
+    epoll_event events[max_events];
+    while (!m_stopped)
+    {
+        // Posted coroutines: no waiting, just what's ready now.
+        auto count = epoll_wait(m_epoll_fd, events, max_events, 
+          idle() ? -1 : 0);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error{std::string{"epoll_wait() failed: "} +
+              std::strerror(errno)};
+        }
+
+        // A resumed session only ever removes its own fd, whose event is
+        //  the one being handled: the other pointers stay valid.
+        for (int i = 0; i < count; i++)
+        {
+            auto& watch = *static_cast<Watch*>(events[i].data.ptr);
+            if (watch.waiter && watch.retry(watch.operation))
+            {
+                std::exchange(watch.waiter, {}).resume();
+            }
+        }
+        resume_posted();
+    }
+}
+
+void EventLoop::run_io_uring()
+{
+    while (!m_stopped)
+    {
+        // What the sessions queued since the last round goes in, and the 
+        //  wait for the next completion, in the same syscall.
+        if (!m_ring->submit(idle() ? 1 : 0))
+        {
+            throw std::runtime_error{std::string{"io_uring_enter() failed: "}
+              + std::strerror(errno)};
+        }
+
+        // One operation per watch at a time: a session that ends frees only
+        //  the watch of the completion being handled.
+        m_ring->reap([](uint64_t user_data, int result)
+          {
+              auto& watch = *reinterpret_cast<Watch*>(user_data);
+              if (watch.complete(watch.operation, result))
+              {
+                  std::exchange(watch.waiter, {}).resume();
+              }
+              else
+              {
+                  watch.queue();
+              }
+          });
+        resume_posted();
+    }
+}
+
+void EventLoop::resume_posted()
+{
+    // The resumed ones may post more: those go in the next round.
+    m_resuming.swap(m_posted);
+    for (auto waiter : m_resuming)
+    {
+        waiter.resume();
+    }
+    m_resuming.clear();
+}
+
+// "8080": TCP port 8080, on any IPv4 address to listen on, 127.0.0.1 to
+//  connect to. "/path": a Unix socket.
+socklen_t socket_address(const std::string& address, bool listening,
+  sockaddr_storage& storage)
+{
+    std::memset(&storage, 0, sizeof(storage));
+    if (!address.empty() && address[0] == '/')
+    {
+        auto& local = reinterpret_cast<sockaddr_un&>(storage);
+        local.sun_family = AF_UNIX;
+        address.copy(local.sun_path, sizeof(local.sun_path) - 1);
+        return sizeof(local);
+    }
+    auto& inet = reinterpret_cast<sockaddr_in&>(storage);
+    inet.sin_family = AF_INET;
+    inet.sin_addr.s_addr = htonl(listening ? INADDR_ANY : INADDR_LOOPBACK);
+    inet.sin_port = htons(std::stoi(address)); // Machine to Network order.
+    return sizeof(inet);
+}
+
+int connect_local(EventLoop& loop, const std::string& address)
+{
+    sockaddr_storage storage;
+    auto size = socket_address(address, false, storage);
+    auto fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    // Blocking: it's local, and once at startup.
+    if (connect(fd, reinterpret_cast<sockaddr*>(&storage), size) < 0)
+    {
+        auto error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    if (!loop.io_uring())
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return fd;
+}
+
+AsyncStream::AsyncStream(EventLoop& loop, int in_fd, int out_fd)
+: m_loop{loop}, m_in_fd{in_fd}, m_out_fd{out_fd}, m_socket{in_fd == out_fd},
+  m_nonblocking{(fcntl(in_fd, F_GETFL) & O_NONBLOCK) != 0}
+{
+    m_loop.add(m_watch, m_in_fd, m_nonblocking);
+}
+
+AsyncStream::~AsyncStream()
+{
+    m_loop.remove(m_watch);
+    if (m_socket)
+    {
+        close(m_in_fd);
+    }
+}
+
+bool AsyncStream::getline(std::string& line)
+{
+    auto end = m_input.find('\n', m_consumed);
+    if (end == std::string::npos)
+    {
+        if (!m_eof || m_consumed == m_input.size())
+        {
+            return false;
+        }
+        end = m_input.size();
+    }
+
+    auto length = end - m_consumed;
+    if (length > 0 && m_input[end - 1] == '\r')
+    {
+        length--;
+    }
+    line.assign(m_input, m_consumed, length);
+    m_consumed = std::min(end + 1, m_input.size());
+    return true;
+}
+
+bool AsyncStream::Read::attempt()
+{
+    // What getline() returned goes now, once per read rather than per line.
+    stream->m_input.erase(0, stream->m_consumed);
+    stream->m_consumed = 0;
+
+    while (true)
+    {
+        auto count = ::read(stream->m_in_fd, stream->m_chunk, read_chunk);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        return complete(count < 0 ? -errno : count);
+    }
+}
+
+void AsyncStream::Read::prepare(io_uring_sqe& sqe)
+{
+    stream->m_input.erase(0, stream->m_consumed);
+    stream->m_consumed = 0;
+
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = stream->m_in_fd;
+    sqe.addr = reinterpret_cast<uint64_t>(stream->m_chunk);
+    sqe.len = read_chunk;
+    sqe.off = uint64_t(-1); // The current position (e.g. a file as stdin).
+}
+
+// 'result': bytes read, or -errno.
+bool AsyncStream::Read::complete(int result)
+{
+    auto& input = stream->m_input;
+    if (result > 0 && input.size() + result <= max_input)
+    {
+        input.append(stream->m_chunk, result);
+        done = true;
+        return true;
+    }
+    if (result == -EINTR || result == -EAGAIN || result == -EWOULDBLOCK)
+    {
+        return false;
+    }
+    // End of input, error, or a line too long: the session ends.
+    stream->m_eof = true;
+    done = false;
+    return true;
+}
+
+bool AsyncStream::Flush::attempt()
+{
+    auto& output = stream->m_output;
+    auto& written = stream->m_written;
+    while (written < output.size())
+    {
+        // No SIGPIPE from a socket whose peer is gone: an error instead.
+        auto count = stream->m_socket ?
+          send(stream->m_out_fd, output.data() + written,
+            output.size() - written, MSG_NOSIGNAL) :
+          ::write(stream->m_out_fd, output.data() + written,
+            output.size() - written);
+        if (count >= 0)
+        {
+            written += count;
+            continue;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && stream->m_socket)
+        {
+            return false;
+        }
+        // A non-blocking stdout isn't watched: waited for here, the console
+        //  being the only session then.
+        pollfd out{stream->m_out_fd, POLLOUT, 0};
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && poll(&out, 1, -1) > 0)
+        {
+            continue;
+        }
+        break;
+    }
+
+    done = written == output.size();
+    output.clear();
+    written = 0;
+    return true;
+}
+
+void AsyncStream::Flush::prepare(io_uring_sqe& sqe)
+{
+    const auto& output = stream->m_output;
+    sqe.fd = stream->m_out_fd;
+    sqe.addr = reinterpret_cast<uint64_t>(output.data() + stream->m_written);
+    sqe.len = output.size() - stream->m_written;
+    if (stream->m_socket)
+    {
+        sqe.opcode = IORING_OP_SEND;
+        sqe.msg_flags = MSG_NOSIGNAL;
+    }
+    else
+    {
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.off = uint64_t(-1);
+    }
+}
+
+// 'result': bytes written, or -errno. The rest of a short write goes again.
+bool AsyncStream::Flush::complete(int result)
+{
+    auto& output = stream->m_output;
+    auto& written = stream->m_written;
+    if (result == -EINTR || result == -EAGAIN || result == -EWOULDBLOCK)
+    {
+        return false;
+    }
+    if (result > 0)
+    {
+        written += result;
+        if (written < output.size())
+        {
+            return false;
+        }
+    }
+
+    done = result > 0;
+    output.clear();
+    written = 0;
+    return true;
+}
+
+Listener::Listener(EventLoop& loop, const std::string& address, 
+  int backlog)
+: m_loop{loop}
+{
+    sockaddr_storage storage;
+    auto size = socket_address(address, true, storage);
+    m_fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC | 
+      (loop.io_uring() ? 0 : SOCK_NONBLOCK), 0);
+    if (m_fd < 0)
+    {
+        throw std::runtime_error{std::string{"socket() failed: "} +
+          std::strerror(errno)};
+    }
+    if (storage.ss_family == AF_UNIX)
+    {
+        // Left over by a previous run.
+        unlink(address.c_str());
+    }
+    else
+    {
+        // A restarted server gets its port back at once, not after 
+        //  TIME_WAIT.
+        int enable = 1;
+        setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    }
+
+    if (bind(m_fd, reinterpret_cast<sockaddr*>(&storage), size) < 0 || 
+      listen(m_fd, backlog) < 0)
+    {
+        auto error = errno;
+        close(m_fd);
+        throw std::runtime_error{"Can't listen on " + address + ": " + 
+          std::strerror(error)};
+    }
+    m_loop.add(m_watch, m_fd, !m_loop.io_uring());
+}
+
+Listener::~Listener()
+{
+    m_loop.remove(m_watch);
+    close(m_fd);
+}
+
+bool Listener::Accept::attempt()
+{
+    while (true)
+    {
+        fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0)
+        {
+            return true;
+        }
+        // A client that gave up before being accepted: next one.
+        if (errno == EINTR || errno == ECONNABORTED)
+        {
+            continue;
+        }
+        // Out of fds: the pending clients wait for the next connection.
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EMFILE ||
+          errno == ENFILE)
+        {
+            return false;
+        }
+        return true;
+    }
+}
+
+void Listener::Accept::prepare(io_uring_sqe& sqe)
+{
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd = listen_fd;
+    sqe.accept_flags = SOCK_CLOEXEC;
+}
+
+// 'result': the client's fd, or -errno.
+bool Listener::Accept::complete(int result)
+{
+    if (result == -EINTR || result == -ECONNABORTED || result == -EAGAIN)
+    {
+        return false;
+    }
+    fd = result >= 0 ? result : -1;
+    if (fd < 0)
+    {
+        errno = -result;
+    }
+    return true;
+}
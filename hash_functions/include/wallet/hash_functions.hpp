@@ -1,6 +1,23 @@
+#pragma once
+
 #include <string>
 #include <cmath>
 #include <vector>
+#include <cstdint>
+#include <cstring> // For memcpy().
+#include <algorithm>
+#include <random> // For random_device.
+#include <immintrin.h> // AVX2 and SHA-NI intrinsics.
+#include <cpuid.h> // For __get_cpuid_count().
+
+
+// The bulk entry points pick AVX2 or the scalar loop at runtime, so the same 
+//  binary runs on machines without AVX2. Checked once, then cached.
+inline bool cpu_has_avx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
 
 
 // Limited if used for Hash Tables because H is also the size of the table and 
@@ -34,7 +51,8 @@ class KnuthHashing
 
     int operator()(int input)
     {
-        return std::floor (H * (input * A % 1));
+        // % is not defined for doubles: fmod() takes the fractional part.
+        return std::floor(H * std::fmod(input * A, 1.0));
     }
 
   private:
@@ -51,38 +69,44 @@ class MultiplicativeHashing
 class UniversalHashing
 {
   public:
-    UniversalHashing(int k = 2)
-    : k(k)
+    // Coefficients drawn from random_device: a fixed rand() sequence would 
+    //  give every process the same function, defeating the purpose.
+    UniversalHashing(int H, int k = 2)
+    : k(k), coefficients(k), H(H)
     {
+        std::random_device device;
         for(auto i = 0; i < k; i++)
         {
-            coefficients[i] = rand();
+            // a != 0, otherwise ax+b degenerates to a constant.
+            coefficients[i] = 1 + device() % (p - 1);
         }
     }
 
-    int operator()(int key)
+    int operator()(int key) const
     {
         // ((ax+b) % p) % H
-        int hash = 0;
+        // Horner on 64 bits: every partial result stays < p < 2^31, so 
+        //  hash*x + c never overflows (no pow() and no doubles either).
+        const uint64_t x = static_cast<uint32_t>(key) % p;
+        uint64_t hash = 0;
 
         // Compute polynomial value.
-        for(auto i = 0; i < k; i++)
+        for(auto i = k - 1; i >= 0; i--)
         {
-            hash += coefficients[i] * std::pow(key, i);
+            // Finite Field property.
+            hash = (hash * x + coefficients[i]) % p;
         }
-        // Finite Field property.
-        hash %= p;
         // Bucket index.
         hash %= H;
 
-        return hash;
+        return static_cast<int>(hash);
     }
 
   private:
     int k;
-    std::vector<int> coefficients;
+    std::vector<uint64_t> coefficients;
     int H; // Also called m, the size of the hash table.
-    int p{2'147'483'647}; // Greatest prime number in 32 bits.
+    static constexpr uint64_t p{2'147'483'647}; // Greatest prime number in 32 bits.
 };
 
 // 
@@ -97,26 +121,40 @@ class FNVHashing
         uint32_t result = offset_basis;
         for (auto byte : message)
         {
-            // Cast implicito da char (uint8) a uint32.
-            result ^= byte;
+            // Cast esplicito a uint8: char può essere signed e l'estensione 
+            //  del segno sporcherebbe i 24 bit alti.
+            result ^= static_cast<uint8_t>(byte);
             result *= prime;
         }
 
         return result;
     }
 
+    // Bulk hashing of short IDs: out[i] = (*this)(messages[i]). Scalar on
+    //  purpose: FNV is one serial multiply per byte, and spreading the bytes
+    //  of 8 IDs of different lengths over AVX2 lanes costs more than it saves
+    //  (measured about 2x slower than this loop on 4-20 byte IDs).
+    void operator()(const std::string* messages, size_t count, uint32_t* out)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = (*this)(messages[i]);
+        }
+    }
+
   private:
     // Valori scelti perchè hanno buone proprietà di distribuzione.
     // Esistono anche le versioni a 64-bit.
-    const uint32_t offset_basis{2166136261u};
-    const uint32_t prime{16777619u};
+    static constexpr uint32_t offset_basis{2166136261u};
+    static constexpr uint32_t prime{16777619u};
+
 };
 
 //
 class xxHashing
 {
 
-}
+};
 
 class xxHash64 {
 private:
@@ -235,6 +273,154 @@ public:
     static uint64_t hash(const std::string& str, uint64_t seed = 0) {
         return hash(str.c_str(), str.length(), seed);
     }
+
+    // Fixed-width keys: same result as hash(&key, sizeof(key), seed), but with
+    //  the length known the generic loops collapse to one step.
+    static uint64_t hash(uint64_t key, uint64_t seed = 0) {
+        uint64_t h64 = seed + PRIME64_5 + 8;
+        h64 ^= round(0, key);
+        h64 = rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+        return avalanche(h64);
+    }
+    static uint64_t hash(uint32_t key, uint64_t seed = 0) {
+        uint64_t h64 = seed + PRIME64_5 + 4;
+        h64 ^= static_cast<uint64_t>(key) * PRIME64_1;
+        h64 = rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+        return avalanche(h64);
+    }
+
+    // Bulk hashing of fixed-width keys: out[i] = hash(keys[i], seed).
+    //  AVX2 hashes 4 keys per iteration (one per 64-bit lane).
+    static void hash_bulk(const uint64_t* keys, size_t count, uint64_t* out, 
+      uint64_t seed = 0) {
+        size_t i = 0;
+        if (cpu_has_avx2()) {
+            i = hash_bulk_avx2(keys, count, out, seed);
+        }
+        for (; i < count; i++) {
+            out[i] = hash(keys[i], seed);
+        }
+    }
+    static void hash_bulk(const uint32_t* keys, size_t count, uint64_t* out, 
+      uint64_t seed = 0) {
+        size_t i = 0;
+        if (cpu_has_avx2()) {
+            i = hash_bulk_avx2(keys, count, out, seed);
+        }
+        for (; i < count; i++) {
+            out[i] = hash(keys[i], seed);
+        }
+    }
+
+private:
+    // AVX2 has no 64-bit multiply: a*b mod 2^64 = lo*lo + ((lo*hi + hi*lo) << 32).
+    __attribute__((target("avx2")))
+    static __m256i mul64(__m256i a, __m256i b) {
+        const __m256i a_hi = _mm256_srli_epi64(a, 32);
+        const __m256i b_hi = _mm256_srli_epi64(b, 32);
+        const __m256i lo = _mm256_mul_epu32(a, b);
+        const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a_hi, b), 
+          _mm256_mul_epu32(a, b_hi));
+        return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i rotl64(__m256i x, int r) {
+        return _mm256_or_si256(_mm256_slli_epi64(x, r), 
+          _mm256_srli_epi64(x, 64 - r));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i avalanche(__m256i h64) {
+        h64 = _mm256_xor_si256(h64, _mm256_srli_epi64(h64, 33));
+        h64 = mul64(h64, _mm256_set1_epi64x(PRIME64_2));
+        h64 = _mm256_xor_si256(h64, _mm256_srli_epi64(h64, 29));
+        h64 = mul64(h64, _mm256_set1_epi64x(PRIME64_3));
+        h64 = _mm256_xor_si256(h64, _mm256_srli_epi64(h64, 32));
+        return h64;
+    }
+
+    // Both return how many keys they hashed, the caller does the tail.
+    __attribute__((target("avx2")))
+    static size_t hash_bulk_avx2(const uint64_t* keys, size_t count, 
+      uint64_t* out, uint64_t seed) {
+        const __m256i prime1 = _mm256_set1_epi64x(PRIME64_1);
+        const __m256i prime2 = _mm256_set1_epi64x(PRIME64_2);
+        const __m256i prime4 = _mm256_set1_epi64x(PRIME64_4);
+        const __m256i start = _mm256_set1_epi64x(seed + PRIME64_5 + 8);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m256i k1 = _mm256_loadu_si256(
+              reinterpret_cast<const __m256i*>(keys + i));
+            k1 = mul64(rotl64(mul64(k1, prime2), 31), prime1);
+            __m256i h64 = _mm256_xor_si256(start, k1);
+            h64 = _mm256_add_epi64(mul64(rotl64(h64, 27), prime1), prime4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), 
+              avalanche(h64));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    static size_t hash_bulk_avx2(const uint32_t* keys, size_t count, 
+      uint64_t* out, uint64_t seed) {
+        const __m256i prime1 = _mm256_set1_epi64x(PRIME64_1);
+        const __m256i prime2 = _mm256_set1_epi64x(PRIME64_2);
+        const __m256i prime3 = _mm256_set1_epi64x(PRIME64_3);
+        const __m256i start = _mm256_set1_epi64x(seed + PRIME64_5 + 4);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            const __m256i k1 = _mm256_cvtepu32_epi64(_mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(keys + i)));
+            __m256i h64 = _mm256_xor_si256(start, mul64(k1, prime1));
+            h64 = _mm256_add_epi64(mul64(rotl64(h64, 23), prime2), prime3);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), 
+              avalanche(h64));
+        }
+        return i;
+    }
+};
+
+// Hasher for std::unordered_map keyed by client-chosen strings (order and 
+//  product IDs). std::hash<std::string> is the same function in every run, so 
+//  colliding keys can be precomputed offline and sent to flood one bucket. 
+//  Here xxHash64 is keyed by a random seed: same idea as Universal Hashing, the
+//  seed picks a function from a family and the attacker doesn't know which.
+class SeededStringHash
+{
+  public:
+    SeededStringHash()
+    : m_seed{process_seed()}
+    {}
+    explicit SeededStringHash(uint64_t seed)
+    : m_seed{seed}
+    {}
+
+    size_t operator()(const std::string& key) const
+    {
+        return xxHash64::hash(key, m_seed);
+    }
+
+    uint64_t seed() const
+    {
+        return m_seed;
+    }
+
+    // Drawn once per process: default-constructed tables all share it.
+    static uint64_t process_seed()
+    {
+        static const uint64_t seed = random_seed();
+        return seed;
+    }
+    // A fresh seed, to rehash a table whose chains grew suspiciously long.
+    static uint64_t random_seed()
+    {
+        std::random_device device;
+        return (static_cast<uint64_t>(device()) << 32) | device();
+    }
+
+  private:
+    uint64_t m_seed;
 };
 
 //
@@ -246,50 +432,109 @@ class SHA256Hashing
     //  Es.: 255 può stare su 1/2/4/8 byte come intero, ma sempre su 3 byte come
     //  stringa.
     std::string operator()(const std::string& message) 
+    {
+        uint8_t digest[digest_size];
+        init();
+        update(message.data(), message.size());
+        final(digest);
+
+        char hex[2 * digest_size];
+        to_hex(digest, hex);
+        return std::string(hex, sizeof(hex));
+    }
+
+    static constexpr size_t digest_size{32};
+
+    // Streaming API: init(), then update() as many times as needed on the 
+    //  caller's buffers, then final(). No allocation: partial blocks wait in 
+    //  m_buffer, full blocks are compressed straight from the caller's memory.
+    void init()
     {
         // Reset hash values
         H[0] = 0x6a09e667; H[1] = 0xbb67ae85; H[2] = 0x3c6ef372; H[3] = 0xa54ff53a;
         H[4] = 0x510e527f; H[5] = 0x9b05688c; H[6] = 0x1f83d9ab; H[7] = 0x5be0cd19;
-        
-        // Convert message to bytes
-        std::vector<uint8_t> data(message.begin(), message.end());
-        uint64_t originalLength = data.size() * 8; // Length in bits
-        
-        // Padding: append single '1' bit
-        data.push_back(0x80);
-        
-        // Pad with zeros until length ≡ 448 (mod 512)
-        while (data.size() % 64 != 56) 
+        m_length = 0;
+        m_buffered = 0;
+    }
+
+    void update(const void* data, size_t length)
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+        m_length += length;
+
+        // Complete the pending partial block first.
+        if (m_buffered > 0)
         {
-            data.push_back(0x00);
+            size_t to_copy = std::min(length, 64 - m_buffered);
+            std::memcpy(m_buffer + m_buffered, bytes, to_copy);
+            m_buffered += to_copy;
+            bytes += to_copy;
+            length -= to_copy;
+            if (m_buffered < 64)
+            {
+                return;
+            }
+            processBlocks(m_buffer, 1);
+            m_buffered = 0;
         }
-        
+
+        // Process message in 512-bit blocks
+        processBlocks(bytes, length / 64);
+        bytes += length / 64 * 64;
+        length %= 64;
+
+        std::memcpy(m_buffer, bytes, length);
+        m_buffered = length;
+    }
+
+    void final(uint8_t digest[digest_size])
+    {
+        uint64_t originalLength = m_length * 8; // Length in bits
+
+        // Padding: append single '1' bit, then zeros until length ≡ 448 
+        //  (mod 512). If the length doesn't fit, it takes one more block.
+        m_buffer[m_buffered++] = 0x80;
+        if (m_buffered > 56)
+        {
+            std::memset(m_buffer + m_buffered, 0, 64 - m_buffered);
+            processBlocks(m_buffer, 1);
+            m_buffered = 0;
+        }
+        std::memset(m_buffer + m_buffered, 0, 56 - m_buffered);
+
         // Append original length as 64-bit big-endian integer
         for (int i = 7; i >= 0; i--) 
         {
-            data.push_back((originalLength >> (i * 8)) & 0xFF);
+            m_buffer[63 - i] = (originalLength >> (i * 8)) & 0xFF;
         }
-        
-        // Process message in 512-bit blocks
-        for (size_t i = 0; i < data.size(); i += 64) 
+        processBlocks(m_buffer, 1);
+
+        // Digest is H[] in big-endian.
+        for (int i = 0; i < 8; i++)
         {
-            processBlock(&data[i]);
+            digest[i * 4] = H[i] >> 24;
+            digest[i * 4 + 1] = H[i] >> 16;
+            digest[i * 4 + 2] = H[i] >> 8;
+            digest[i * 4 + 3] = H[i];
         }
-        
-        // Convert hash to hex string
-        std::stringstream ss;
-        for (int i = 0; i < 8; i++) 
+    }
+
+    // Convert hash to hex string, into the caller's buffer (no terminator).
+    static void to_hex(const uint8_t digest[digest_size], 
+      char hex[2 * digest_size])
+    {
+        constexpr char digits[] = "0123456789abcdef";
+        for (size_t i = 0; i < digest_size; i++)
         {
-            ss << std::hex << std::setfill('0') << std::setw(8) << H[i];
+            hex[i * 2] = digits[digest[i] >> 4];
+            hex[i * 2 + 1] = digits[digest[i] & 0x0F];
         }
-        
-        return ss.str();
     }
 
   private:
     // SHA-256 constants definitions. The first 32 bits (MSBs) of:
     // - fractional parts of cube roots of first 64 primes;
-    const uint32_t K[64] = 
+    static constexpr uint32_t K[64] = 
     {
         0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
         0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
@@ -306,6 +551,10 @@ class SHA256Hashing
         0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
         0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
     };
+    // Streaming state: the partial block and the total length in bytes.
+    uint8_t m_buffer[64];
+    size_t m_buffered{0};
+    uint64_t m_length{0};
 
     /*
     ** Methods
@@ -389,4 +638,102 @@ class SHA256Hashing
         H[0] += a; H[1] += b; H[2] += c; H[3] += d;
         H[4] += e; H[5] += f; H[6] += g; H[7] += h;
     }
+
+    // SHA extensions (SHA-NI) since Goldmont/Ice Lake/Zen: CPUID leaf 7, 
+    //  EBX bit 29. Checked once, then cached.
+    static bool cpu_has_sha()
+    {
+        static const bool has_sha = []{
+            unsigned eax, ebx, ecx, edx;
+            if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            {
+                return false;
+            }
+            return (ebx & (1u << 29)) != 0 && __builtin_cpu_supports("sse4.1");
+        }();
+        return has_sha;
+    }
+
+    // Process 'count' consecutive 512-bit blocks: SHA-NI when available, 
+    //  processBlock() otherwise.
+    void processBlocks(const uint8_t* blocks, size_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (cpu_has_sha())
+        {
+            processBlocksShaNi(blocks, count);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            processBlock(blocks + i * 64);
+        }
+    }
+
+    // Same compression with the SHA-NI instructions: sha256rnds2 does 2 rounds,
+    //  sha256msg1/msg2 compute the Message Schedule 4 words at a time. The 
+    //  instructions want the state split as ABEF/CDGH instead of H[0..7].
+    __attribute__((target("sha,sse4.1")))
+    void processBlocksShaNi(const uint8_t* blocks, size_t count)
+    {
+        // Words are big-endian in the message: byte swap each 32-bit lane.
+        const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 
+          0x0405060700010203ULL);
+
+        __m128i TMP = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&H[0]));
+        __m128i STATE1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&H[4]));
+        TMP = _mm_shuffle_epi32(TMP, 0xB1); // CDAB
+        STATE1 = _mm_shuffle_epi32(STATE1, 0x1B); // EFGH
+        __m128i STATE0 = _mm_alignr_epi8(TMP, STATE1, 8); // ABEF
+        STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0); // CDGH
+
+        for (size_t block = 0; block < count; block++, blocks += 64)
+        {
+            const __m128i ABEF_SAVE = STATE0;
+            const __m128i CDGH_SAVE = STATE1;
+            __m128i W[4];
+
+            // 16 groups of 4 rounds. W[] is a sliding window on the Message 
+            //  Schedule: group i consumes W[i%4] and prepares W[(i+1)%4].
+#pragma GCC unroll 16
+            for (int i = 0; i < 16; i++)
+            {
+                if (i < 4)
+                {
+                    W[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+                      reinterpret_cast<const __m128i*>(blocks + i * 16)), MASK);
+                }
+                __m128i MSG = _mm_add_epi32(W[i % 4], 
+                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(&K[i * 4])));
+                STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+                if (i >= 3 && i <= 14)
+                {
+                    TMP = _mm_alignr_epi8(W[i % 4], W[(i + 3) % 4], 4);
+                    W[(i + 1) % 4] = _mm_add_epi32(W[(i + 1) % 4], TMP);
+                    W[(i + 1) % 4] = _mm_sha256msg2_epu32(W[(i + 1) % 4], 
+                      W[i % 4]);
+                }
+                MSG = _mm_shuffle_epi32(MSG, 0x0E);
+                STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+                if (i >= 1 && i <= 12)
+                {
+                    W[(i + 3) % 4] = _mm_sha256msg1_epu32(W[(i + 3) % 4], 
+                      W[i % 4]);
+                }
+            }
+
+            STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+            STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        }
+
+        TMP = _mm_shuffle_epi32(STATE0, 0x1B); // FEBA
+        STATE1 = _mm_shuffle_epi32(STATE1, 0xB1); // DCHG
+        STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0); // DCBA
+        STATE1 = _mm_alignr_epi8(STATE1, TMP, 8); // HGFE
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&H[0]), STATE0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&H[4]), STATE1);
+    }
 };
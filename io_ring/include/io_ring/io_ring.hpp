@@ -0,0 +1,449 @@
+// io_uring through its raw syscalls (no liburing): the submission and
+//  completion rings are shared memory with the kernel, so any number of
+//  operations go in with one io_uring_enter() and their results come back
+//  with none.
+// - IoRing: the rings. Queue SQEs (sqe()), submit them all at once (submit(),
+//    optionally waiting for completions in the same syscall), read the CQEs
+//    (reap()).
+// - JournalFile: an append-only file for the journal and the snapshots.
+//    Writes are buffered, one write per commit(), with the commit's fdatasync
+//    linked behind it (group commit: one sync for everything since the last
+//    commit). With io_uring the two buffers are registered with the kernel
+//    (no page pinning per write) and the write is asynchronous: the next
+//    batch fills while the previous one is in flight.
+// io_uring is optional: without it (old kernel, disabled by sysctl or by a
+//  seccomp filter) available() is false, and JournalFile falls back to plain
+//  write()/fdatasync().
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+// POSIX/Linux
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+class IoRing
+{
+  public:
+    // 'entries': SQEs queued before a submit() is forced.
+    explicit IoRing(unsigned entries = 256);
+    ~IoRing();
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    // False if the kernel refused io_uring: nothing else may be called.
+    bool available() const
+    {
+        return m_fd >= 0;
+    }
+    // Why it's not available.
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+    // The next free SQE, zeroed, for the caller to fill. Submits the queued
+    //  ones first if the ring is full.
+    io_uring_sqe& sqe();
+    // Queued SQEs, not submitted yet.
+    unsigned queued() const
+    {
+        return m_sq_tail - std::atomic_ref<uint32_t>{*m_sq_head_shared}.load(
+          std::memory_order_acquire);
+    }
+    // Submits everything queued and waits for at least 'wait' completions,
+    //  all in one syscall. Returns false on error (errno set).
+    bool submit(unsigned wait = 0);
+
+    // Calls handle(user_data, result) for each completion there is; returns
+    //  how many. Needs no syscall.
+    template <typename Handler>
+    size_t reap(Handler&& handle);
+
+    // Buffers the kernel maps once, for IORING_OP_READ/WRITE_FIXED (by
+    //  index in 'buffers').
+    bool register_buffers(const iovec* buffers, unsigned count);
+
+  private:
+    int m_fd{-1};
+    std::string m_error;
+
+    void* m_sq_ring{MAP_FAILED};
+    size_t m_sq_ring_size{0};
+    void* m_cq_ring{MAP_FAILED};
+    size_t m_cq_ring_size{0};
+    io_uring_sqe* m_sqes{static_cast<io_uring_sqe*>(MAP_FAILED)};
+    size_t m_sqes_size{0};
+
+    // In the shared rings.
+    uint32_t* m_sq_tail_shared{nullptr};
+    uint32_t* m_cq_head_shared{nullptr};
+    uint32_t* m_cq_tail_shared{nullptr};
+    io_uring_cqe* m_cqes{nullptr};
+    uint32_t m_sq_mask{0};
+    uint32_t m_sq_entries{0};
+    uint32_t m_cq_mask{0};
+    uint32_t* m_sq_head_shared{nullptr};
+
+    uint32_t m_sq_tail{0}; // Local copy: published at submit().
+};
+
+class JournalFile
+{
+  public:
+    // Bytes per buffer: a commit() is forced when one fills up.
+    static constexpr size_t buffer_size{1 << 20};
+
+    JournalFile() = default;
+    ~JournalFile()
+    {
+        close();
+    }
+    JournalFile(const JournalFile&) = delete;
+    JournalFile& operator=(const JournalFile&) = delete;
+
+    // Truncates 'filename'. 'sync': every commit() ends with an fdatasync.
+    bool open(const std::string& filename, bool sync,
+      bool try_io_uring = true);
+    // Commits and waits for everything.
+    void close();
+
+    bool is_open() const
+    {
+        return m_fd >= 0;
+    }
+    bool io_uring() const
+    {
+        return m_ring != nullptr;
+    }
+
+    void write(const void* data, size_t size);
+    // Hands the buffered data to the kernel, with its fdatasync if 'sync'.
+    //  With io_uring it returns at once and the data is in flight, done at
+    //  the latest by the next commit().
+    void commit();
+
+  private:
+    int m_fd{-1};
+    bool m_sync{false};
+    uint64_t m_offset{0}; // End of the file, buffered data excluded.
+    std::unique_ptr<IoRing> m_ring;
+    std::unique_ptr<char[]> m_buffers[2];
+    size_t m_used{0}; // In the current buffer.
+    int m_current{0};
+    unsigned m_in_flight{0}; // Completions to wait for.
+    // The in-flight write, redone by hand if the kernel wrote less.
+    size_t m_flight_size{0};
+    uint64_t m_flight_offset{0};
+    bool m_flight_failed{false};
+
+    void wait_in_flight();
+    void write_sync(const char* data, size_t size, uint64_t offset);
+};
+
+IoRing::IoRing(unsigned entries)
+{
+    io_uring_params params{};
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0)
+    {
+        m_error = std::string{"io_uring_setup() failed: "} +
+          std::strerror(errno);
+        return;
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cq_ring_size = params.cq_off.cqes +
+      params.cq_entries * sizeof(io_uring_cqe);
+    // Since 5.4 both rings are in one mapping.
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size,
+          m_cq_ring_size);
+    }
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    m_cq_ring = single_mmap ? m_sq_ring : mmap(nullptr, m_cq_ring_size,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+      IORING_OFF_CQ_RING);
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqes_size,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd,
+      IORING_OFF_SQES));
+    if (m_sq_ring == MAP_FAILED || m_cq_ring == MAP_FAILED ||
+      m_sqes == MAP_FAILED)
+    {
+        m_error = std::string{"io_uring mmap() failed: "} +
+          std::strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    auto sq = static_cast<char*>(m_sq_ring);
+    auto cq = static_cast<char*>(m_cq_ring);
+    m_sq_head_shared = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+    m_sq_tail_shared = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_cq_head_shared = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    m_cq_tail_shared = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // SQE i always sits at index i of the array: filled once, here.
+    auto array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    for (uint32_t i = 0; i < params.sq_entries; i++)
+    {
+        array[i] = i;
+    }
+    m_sq_tail = *m_sq_tail_shared;
+}
+
+IoRing::~IoRing()
+{
+    if (m_sqes != MAP_FAILED)
+    {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+    {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    if (m_sq_ring != MAP_FAILED)
+    {
+        munmap(m_sq_ring, m_sq_ring_size);
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+}
+
+io_uring_sqe& IoRing::sqe()
+{
+    // The kernel consumes SQEs at submit(): the ring is full when everything
+    //  since its head is queued.
+    if (queued() >= m_sq_entries)
+    {
+        submit();
+    }
+    auto& entry = m_sqes[m_sq_tail & m_sq_mask];
+    std::memset(&entry, 0, sizeof(entry));
+    m_sq_tail++;
+    return entry;
+}
+
+bool IoRing::submit(unsigned wait)
+{
+    // The SQEs are written before the kernel can see the new tail. The 
+    //  kernel moves the head past the ones it consumed.
+    std::atomic_ref<uint32_t>{*m_sq_tail_shared}.store(m_sq_tail,
+      std::memory_order_release);
+    auto result = syscall(__NR_io_uring_enter, m_fd, queued(), wait,
+      wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    // Interrupted while waiting: the caller reaps what there is, if any, and
+    //  comes back.
+    return result >= 0 || errno == EINTR;
+}
+
+template <typename Handler>
+size_t IoRing::reap(Handler&& handle)
+{
+    auto head = *m_cq_head_shared;
+    const auto tail = std::atomic_ref<uint32_t>{*m_cq_tail_shared}.load(
+      std::memory_order_acquire);
+    size_t count = 0;
+    while (head != tail)
+    {
+        const auto& cqe = m_cqes[head & m_cq_mask];
+        auto user_data = cqe.user_data;
+        auto result = cqe.res;
+        // Released before the handler runs: it may queue and submit more.
+        head++;
+        std::atomic_ref<uint32_t>{*m_cq_head_shared}.store(head,
+          std::memory_order_release);
+        handle(user_data, result);
+        count++;
+    }
+    return count;
+}
+
+bool IoRing::register_buffers(const iovec* buffers, unsigned count)
+{
+    return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS,
+      buffers, count) == 0;
+}
+
+bool JournalFile::open(const std::string& filename, bool sync,
+  bool try_io_uring)
+{
+    if (m_fd >= 0)
+    {
+        return false;
+    }
+    m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      0644);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    m_sync = sync;
+    m_offset = 0;
+    m_used = 0;
+    m_current = 0;
+    for (auto& buffer : m_buffers)
+    {
+        buffer = std::make_unique<char[]>(buffer_size);
+    }
+
+    if (try_io_uring)
+    {
+        m_ring = std::make_unique<IoRing>(8);
+        iovec buffers[2] = {{m_buffers[0].get(), buffer_size},
+          {m_buffers[1].get(), buffer_size}};
+        if (!m_ring->available() || !m_ring->register_buffers(buffers, 2))
+        {
+            m_ring.reset();
+        }
+    }
+    return true;
+}
+
+void JournalFile::close()
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+    commit();
+    wait_in_flight();
+    m_ring.reset();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+void JournalFile::write(const void* data, size_t size)
+{
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        auto chunk = std::min(size, buffer_size - m_used);
+        std::memcpy(m_buffers[m_current].get() + m_used, bytes, chunk);
+        m_used += chunk;
+        bytes += chunk;
+        size -= chunk;
+        if (m_used == buffer_size)
+        {
+            commit();
+        }
+    }
+}
+
+void JournalFile::commit()
+{
+    if (m_used == 0)
+    {
+        return;
+    }
+    auto data = m_buffers[m_current].get();
+
+    if (!m_ring)
+    {
+        write_sync(data, m_used, m_offset);
+        if (m_sync)
+        {
+            fdatasync(m_fd);
+        }
+        m_offset += m_used;
+        m_used = 0;
+        return;
+    }
+
+    // The other buffer is the one in flight: done before it's filled again.
+    wait_in_flight();
+    auto& write = m_ring->sqe();
+    write.opcode = IORING_OP_WRITE_FIXED;
+    write.fd = m_fd;
+    write.addr = reinterpret_cast<uint64_t>(data);
+    write.len = m_used;
+    write.off = m_offset;
+    write.buf_index = m_current;
+    m_in_flight = 1;
+    if (m_sync)
+    {
+        // Runs only once the write is done; canceled if it failed.
+        write.flags = IOSQE_IO_LINK;
+        auto& sync = m_ring->sqe();
+        sync.opcode = IORING_OP_FSYNC;
+        sync.fd = m_fd;
+        sync.fsync_flags = IORING_FSYNC_DATASYNC;
+        sync.user_data = 1;
+        m_in_flight = 2;
+    }
+    m_ring->submit();
+
+    m_flight_size = m_used;
+    m_flight_offset = m_offset;
+    m_offset += m_used;
+    m_used = 0;
+    m_current ^= 1;
+}
+
+void JournalFile::wait_in_flight()
+{
+    while (m_in_flight > 0)
+    {
+        m_ring->submit(m_in_flight);
+        m_ring->reap([this](uint64_t user_data, int result)
+          {
+              m_in_flight--;
+              // The write (user_data 0) came up short or failed: the rest
+              //  goes the plain way, and so does the sync it canceled.
+              if (user_data == 0 && result != int(m_flight_size))
+              {
+                  auto done = result > 0 ? size_t(result) : 0;
+                  write_sync(m_buffers[m_current ^ 1].get() + done,
+                    m_flight_size - done, m_flight_offset + done);
+                  m_flight_failed = true;
+              }
+              else if (user_data == 1 && m_flight_failed)
+              {
+                  fdatasync(m_fd);
+              }
+          });
+    }
+    m_flight_failed = false;
+}
+
+void JournalFile::write_sync(const char* data, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        auto written = pwrite(m_fd, data, size, offset);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return; // Disk full or I/O error: nothing better to do here.
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
@@ -0,0 +1,370 @@
+// Low-latency logger. The logging thread doesn't format anything: it writes a
+//  64-byte binary record (TSC timestamp, format ID, raw arguments) into its own
+//  SPSC ring and moves on. A background thread drains all the rings in batches
+//  and writes the records to a file, as they are (binary, rendered offline by 
+//  log_decode) or rendered to text. Each drain pass is one write to the 
+//  journal file (io_uring when the kernel has it, see JournalFile), and one 
+//  fdatasync if the log is opened 'sync': a group commit of everything the 
+//  pass found.
+// Never blocks: with the ring full the record is dropped and counted. Costs a
+//  relaxed load when the logger isn't open.
+//
+// Usage:
+//  Logger::instance().open("book.log", true);  // Binary; false for text.
+//  Logger::instance().open("book.log", true, true);  // Durable, fdatasync'd.
+//  LOG(LogFormat::CREATE, orderID, success);
+//  Logger::instance().close();
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <x86intrin.h> // For __rdtsc().
+#include "../../../spsc_ring/include/spsc_ring/spsc_ring.hpp"
+#include "../../../io_ring/include/io_ring/io_ring.hpp"
+
+
+// Format IDs: the record stores the ID, the string lives only here (and in 
+//  the decoder, which includes this header). Append only: IDs are written to 
+//  files. '{}' is replaced by the next argument.
+enum class LogFormat : uint16_t
+{
+    CREATE,
+    DELETE,
+    MODIFY,
+    HANDOFF_OUT,
+    HANDOFF_IN,
+    EXPIRE,
+    MASS_DELETE,
+    CANCEL_SESSION,
+    TRADE,
+    COUNT // Number of formats, not a format.
+};
+
+inline const char* log_format_string(uint16_t format)
+{
+    static const char* formats[] = {
+        "CREATE orderID={} productID={} price={} quantity={} success={}",
+        "DELETE orderID={} success={}",
+        "MODIFY orderID={} price={} quantity={} success={}",
+        "HANDOFF_OUT productID={} orders={}",
+        "HANDOFF_IN orders={} success={}",
+        "EXPIRE orderID={}",
+        "MASS_DELETE productID={} orders={}",
+        "CANCEL_SESSION session={} orders={}",
+        "TRADE productID={} price={} quantity={} success={}",
+    };
+    return format < static_cast<uint16_t>(LogFormat::COUNT) ? formats[format] : 
+      "<unknown format>";
+}
+
+// Arguments are packed one after the other in 'payload': integers in 8 bytes, 
+//  strings as 1 length byte plus up to 15 chars (longer ones are cut). 
+//  'types' has 2 bits per argument.
+struct LogRecord
+{
+    enum ArgType : uint8_t
+    {
+        UNSIGNED,
+        SIGNED,
+        STRING
+    };
+    static constexpr size_t max_args{8};
+    static constexpr size_t max_string{15};
+
+    uint64_t tsc;
+    uint16_t format;
+    uint16_t types;
+    uint8_t count;
+    uint8_t padding[3];
+    uint8_t payload[48];
+};
+static_assert(sizeof(LogRecord) == 64);
+
+// Binary file: a LogFileHeader, then LogRecords.
+struct LogFileHeader
+{
+    char magic[8]; // "OBLOG001"
+    uint64_t tsc_hz;
+    // The same instant on both clocks, to turn a TSC into wall-clock time.
+    uint64_t tsc_anchor;
+    uint64_t realtime_ns_anchor;
+};
+
+// "[2025-01-31 12:00:00.123456789] CREATE orderID=1 ..." into 'out'.
+inline void render_log_record(const LogRecord& record, 
+  const LogFileHeader& header, std::string& out)
+{
+    const double ticks = static_cast<double>(record.tsc) - 
+      static_cast<double>(header.tsc_anchor);
+    const int64_t ns = header.realtime_ns_anchor + 
+      static_cast<int64_t>(ticks * 1e9 / header.tsc_hz);
+    std::time_t seconds = ns / 1'000'000'000;
+    std::tm calendar;
+    gmtime_r(&seconds, &calendar);
+    char prefix[48];
+    auto length = std::strftime(prefix, sizeof(prefix), "[%Y-%m-%d %H:%M:%S", 
+      &calendar);
+    length += std::snprintf(prefix + length, sizeof(prefix) - length, 
+      ".%09lld] ", static_cast<long long>(ns % 1'000'000'000));
+    out.assign(prefix, length);
+
+    const char* format = log_format_string(record.format);
+    size_t offset = 0;
+    uint8_t arg = 0;
+    for (; *format; format++)
+    {
+        if (format[0] != '{' || format[1] != '}' || arg >= record.count)
+        {
+            out += *format;
+            continue;
+        }
+        format++;
+
+        auto type = (record.types >> (arg * 2)) & 3;
+        if (type == LogRecord::STRING)
+        {
+            auto size = record.payload[offset];
+            out.append(reinterpret_cast<const char*>(&record.payload[offset + 1]),
+              size);
+            offset += 1 + size;
+        }
+        else
+        {
+            uint64_t value;
+            std::memcpy(&value, &record.payload[offset], sizeof(value));
+            out += type == LogRecord::SIGNED ? 
+              std::to_string(static_cast<int64_t>(value)) : 
+              std::to_string(value);
+            offset += sizeof(value);
+        }
+        arg++;
+    }
+    out += '\n';
+}
+
+class Logger
+{
+  public:
+    static constexpr size_t ring_capacity{1 << 14};
+
+    static Logger& instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    bool open(const std::string& filename, bool binary = true, 
+      bool sync = false);
+    void close();
+
+    bool enabled() const
+    {
+        return m_running.load(std::memory_order_relaxed);
+    }
+
+    template <typename... Args>
+    void log(LogFormat format, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= LogRecord::max_args);
+        auto ring = t_ring;
+        if (ring == nullptr)
+        {
+            ring = register_thread();
+        }
+
+        LogRecord record;
+        record.tsc = __rdtsc();
+        record.format = static_cast<uint16_t>(format);
+        record.types = 0;
+        record.count = 0;
+        size_t offset = 0;
+        (encode(record, offset, args), ...);
+
+        if (!ring->try_push(record))
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    Logger() = default;
+    ~Logger()
+    {
+        close();
+    }
+
+    // Arguments that don't fit in the payload any more are left out.
+    static void encode(LogRecord& record, size_t& offset, std::string_view value)
+    {
+        auto size = std::min(value.size(), LogRecord::max_string);
+        if (offset + 1 + size > sizeof(record.payload))
+        {
+            return;
+        }
+        record.payload[offset] = static_cast<uint8_t>(size);
+        std::memcpy(&record.payload[offset + 1], value.data(), size);
+        offset += 1 + size;
+        record.types |= LogRecord::STRING << (record.count++ * 2);
+    }
+    static void encode(LogRecord& record, size_t& offset, 
+      const std::string& value)
+    {
+        encode(record, offset, std::string_view{value});
+    }
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> || 
+      std::is_enum_v<T>>>
+    static void encode(LogRecord& record, size_t& offset, T value)
+    {
+        if (offset + sizeof(uint64_t) > sizeof(record.payload))
+        {
+            return;
+        }
+        uint64_t bits = static_cast<uint64_t>(value);
+        std::memcpy(&record.payload[offset], &bits, sizeof(bits));
+        offset += sizeof(bits);
+        uint16_t type = std::is_signed_v<T> ? LogRecord::SIGNED : 
+          LogRecord::UNSIGNED;
+        record.types |= type << (record.count++ * 2);
+    }
+
+    SpscRing<LogRecord>* register_thread();
+    void drain_loop();
+    size_t drain_once();
+
+    std::mutex m_mutex; // Guards m_rings and m_journal (cold paths only).
+    std::vector<std::unique_ptr<SpscRing<LogRecord>>> m_rings;
+    JournalFile m_journal;
+    bool m_binary{true};
+    LogFileHeader m_header;
+    std::thread m_writer;
+    std::atomic<bool> m_running{false};
+    std::atomic<uint64_t> m_dropped{0};
+
+    static inline thread_local SpscRing<LogRecord>* t_ring{nullptr};
+};
+
+bool Logger::open(const std::string& filename, bool binary, bool sync)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_journal.is_open() || !m_journal.open(filename, sync))
+    {
+        return false;
+    }
+    m_binary = binary;
+
+    // TSC frequency against steady_clock over ~10 ms, then one anchor pair.
+    auto start_time = std::chrono::steady_clock::now();
+    auto start_tsc = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto end_tsc = __rdtsc();
+    auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time).count();
+
+    std::memcpy(m_header.magic, "OBLOG001", sizeof(m_header.magic));
+    m_header.tsc_hz = static_cast<uint64_t>((end_tsc - start_tsc) / elapsed);
+    m_header.tsc_anchor = __rdtsc();
+    m_header.realtime_ns_anchor = std::chrono::duration_cast<
+      std::chrono::nanoseconds>(std::chrono::system_clock::now()
+      .time_since_epoch()).count();
+    if (m_binary)
+    {
+        m_journal.write(&m_header, sizeof(m_header));
+    }
+
+    m_running = true;
+    m_writer = std::thread{&Logger::drain_loop, this};
+    return true;
+}
+
+void Logger::close()
+{
+    if (!m_running.exchange(false))
+    {
+        return;
+    }
+    m_writer.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_journal.close();
+}
+
+SpscRing<LogRecord>* Logger::register_thread()
+{
+    // Once per thread; rings outlive their threads, see Tracer.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rings.push_back(std::make_unique<SpscRing<LogRecord>>(ring_capacity));
+    t_ring = m_rings.back().get();
+    return t_ring;
+}
+
+size_t Logger::drain_once()
+{
+    constexpr size_t batch_size = 1024;
+    static LogRecord batch[batch_size]; // Writer thread only.
+    static std::string line;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t drained = 0;
+    for (auto& ring : m_rings)
+    {
+        size_t count;
+        while ((count = ring->pop_batch(batch, batch_size)) > 0)
+        {
+            if (m_binary)
+            {
+                m_journal.write(batch, count * sizeof(LogRecord));
+            }
+            else
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    render_log_record(batch[i], m_header, line);
+                    m_journal.write(line.data(), line.size());
+                }
+            }
+            drained += count;
+        }
+    }
+    // One write for the whole pass, in flight while the next pass drains.
+    m_journal.commit();
+    return drained;
+}
+
+void Logger::drain_loop()
+{
+    while (m_running.load(std::memory_order_relaxed))
+    {
+        if (drain_once() == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    drain_once();
+}
+
+// Checks enabled() first, so the arguments aren't even encoded when off.
+#define LOG(format, ...) \
+    do \
+    { \
+        if (Logger::instance().enabled()) \
+        { \
+            Logger::instance().log(format, __VA_ARGS__); \
+        } \
+    } while (0)
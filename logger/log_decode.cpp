@@ -0,0 +1,39 @@
+// Renders the binary files written by Logger (see logger.hpp) as text.
+// Usage: log_decode <file>
+
+// C++ standard
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <string>
+// Custom
+#include "include/logger/logger.hpp"
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: log_decode <file>\n";
+        return 1;
+    }
+
+    std::ifstream file{argv[1], std::ios::binary};
+    LogFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || 
+      std::memcmp(header.magic, "OBLOG001", sizeof(header.magic)) != 0)
+    {
+        std::cerr << "Not a binary log: " << argv[1] << "\n";
+        return 1;
+    }
+
+    LogRecord record;
+    std::string line;
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        render_log_record(record, header, line);
+        std::cout << line;
+    }
+
+    return 0;
+}
@@ -5,142 +5,699 @@
 // - authentication/authorization
 
 // C++ standard
+#include <cstdlib> // For getenv().
+#include <cstring> // For strerror().
+#include <cerrno>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <charconv> // For from_chars().
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
 #include <string>
 #include <map>
 // POSIX
-#include <sys/socket.h> // For APIs like socket(), bind(), etc.
-#include <netinet/in.h> // For the socket address struct like sockaddr_in.
-#include <unistd.h> // For close(), read(), write().
+#include <unistd.h> // For STDIN_FILENO, STDOUT_FILENO.
 // Custom
 #include "order_book.hpp"
 #include "order_book_parser.hpp"
+#include "perf_counters/include/perf_counters/perf_counters.hpp"
+#include "event_loop/include/event_loop/event_loop.hpp"
+#include "replication/include/replication/replication_log.hpp"
+#include "checkpoint/include/checkpoint/checkpoint.hpp"
+#include "book_thread.hpp"
 
 
-void network_mod();
+// Expired orders dropped per command or per housekeeping tick, at most.
+constexpr size_t expire_batch{256};
+constexpr uint64_t housekeeping_period_ns{1'000'000};
+
+// What all the sessions share: one book, and one thread for all of them 
+//  (the book's, unless it has a thread of its own): no lock needed.
+struct Frontend
+{
+    OrderBookParser& order_book;
+    const std::vector<std::string>& commands;
+    PerfCounters* counters;
+    PhaseProfile* profile;
+    // Set: the book is on this thread, the sessions submit jobs to it.
+    BookThread* book_thread;
+    uint64_t request{0};
+    // Session IDs are reused, so that they stay small (see 
+    //  OrderBook::Limits::max_sessions).
+    std::vector<uint32_t> free_sessions{};
+    uint32_t next_session{1};
+    // Hot standby: the leader's mutations only, clients get the reads (GET,
+    //  AGGREGATED_BEST, SWEEP, BARS, TRADES). Until the leader goes away.
+    bool following{false};
+};
+
+Task session(EventLoop& loop, Frontend& frontend, int in_fd, int out_fd, 
+  uint32_t session_id);
+Task housekeeping(Frontend& frontend, Timer& timer);
+Task accept_clients(EventLoop& loop, Listener& listener, Frontend& frontend);
+Task serve_follower(EventLoop& loop, OrderBook& order_book, 
+  ReplicationLog& replication, int fd);
+Task accept_followers(EventLoop& loop, Listener& listener, 
+  OrderBook& order_book, ReplicationLog& replication);
+Task follow(EventLoop& loop, Frontend& frontend, std::string leader);
 
 int main(int argc, char** argv)
 {
+    // ORDER_BOOK_IO_CPUS=2[,3...] pins this thread, the event loop's, and 
+    //  the ones it starts (logger, tracer) to these CPUs.
+    if (auto io_cpus = std::getenv("ORDER_BOOK_IO_CPUS"))
+    {
+        pin_thread(io_cpus);
+    }
+
+    // ORDER_BOOK_IO=epoll: no io_uring even if the kernel has it.
+    auto io = std::getenv("ORDER_BOOK_IO");
+    EventLoop loop{io == nullptr || std::string{io} != "epoll"};
+
+    // ORDER_BOOK_SHM=/name publishes the book depth in shared memory, for 
+    //  local readers (see shared_book.md).
+    std::unique_ptr<SharedBookWriter> shared_book;
+    if (auto shm_name = std::getenv("ORDER_BOOK_SHM"))
+    {
+        constexpr uint32_t max_products = 4096;
+        shared_book = std::make_unique<SharedBookWriter>(shm_name, max_products);
+    }
+
+    // ORDER_BOOK_CHECKPOINT=name checkpoints the book into name.1, name.2, 
+    //  ... every ORDER_BOOK_CHECKPOINT_MS (default 2000 ms), between 
+    //  commands, and recovers it from there at startup (see checkpoint.hpp).
+    //  Not on a follower: its book is the leader's.
+    auto checkpoint_name = std::getenv("ORDER_BOOK_CHECKPOINT");
+    if (checkpoint_name && std::getenv("ORDER_BOOK_FOLLOW"))
+    {
+        std::cerr << "ORDER_BOOK_CHECKPOINT: not on a follower\n";
+        return 1;
+    }
+    std::unique_ptr<CheckpointFile> checkpoints;
+    if (checkpoint_name)
+    {
+        auto interval_ms = std::getenv("ORDER_BOOK_CHECKPOINT_MS");
+        checkpoints = std::make_unique<CheckpointFile>(interval_ms ? 
+          std::stoull(interval_ms) * 1'000'000 : 2'000'000'000);
+    }
+
+    // ORDER_BOOK_LIMITS=orders,products,levels[,sessions] runs a 
+    //  bounded-memory book: all reserved now, commands beyond the limits get 
+    //  ERROR (see OrderBook::Limits).
+    // ORDER_BOOK_NUMERIC_IDS=max_id indexes numeric order IDs up to max_id 
+    //  directly, without hashing (see OrderBook::index_numeric_ids()).
+    // ORDER_BOOK_BARS=1000,60000 sets the trade tape's bar intervals, in ms 
+    //  (default: 1 s and 1 min, see TradeTape).
+    auto make_book = [&shared_book, &checkpoints, checkpoint_name]
+      {
+          std::unique_ptr<OrderBookParser> parser;
+          if (auto limits_s = std::getenv("ORDER_BOOK_LIMITS"))
+          {
+              OrderBook::Limits limits{};
+              char comma;
+              std::istringstream ss{limits_s};
+              ss >> limits.max_orders >> comma >> limits.max_products >> comma
+                >> limits.max_levels;
+              if (ss >> comma)
+              {
+                  ss >> limits.max_sessions;
+              }
+              parser = std::make_unique<OrderBookParser>(limits);
+          }
+          else
+          {
+              parser = std::make_unique<OrderBookParser>();
+          }
+          if (auto max_id = std::getenv("ORDER_BOOK_NUMERIC_IDS"))
+          {
+              parser->book().index_numeric_ids(std::stoull(max_id));
+          }
+          TradeTape::Config tape{};
+          if (auto bars_s = std::getenv("ORDER_BOOK_BARS"))
+          {
+              tape.intervals_ns.clear();
+              std::istringstream ss{bars_s};
+              std::string interval_s;
+              while (std::getline(ss, interval_s, ','))
+              {
+                  tape.intervals_ns.push_back(std::stoull(interval_s) * 
+                    1'000'000);
+              }
+          }
+          if (!parser->book().enable_tape(tape))
+          {
+              throw std::runtime_error{"Invalid ORDER_BOOK_BARS"};
+          }
+          parser->book().attach_shared_book(shared_book.get());
+          if (checkpoints)
+          {
+              CheckpointImage image;
+              if (!checkpoints->open(checkpoint_name, image) || 
+                !parser->book().restore(image))
+              {
+                  throw std::runtime_error{std::string{"Can't recover the "
+                    "checkpoints of "} + checkpoint_name};
+              }
+              parser->book().attach_checkpoints(checkpoints.get());
+          }
+          return parser;
+      };
+
+    // ORDER_BOOK_BOOK_CPU=3 runs the book on its own thread, pinned to CPU 3
+    //  and busy-polling (see book_thread.hpp); ORDER_BOOK_IDLE=spin, pause 
+    //  (default) or backoff is what it does between requests. Otherwise the
+    //  book runs on the event loop's thread.
+    std::unique_ptr<OrderBookParser> parser;
+    std::unique_ptr<BookThread> book_thread;
+    if (auto book_cpu = std::getenv("ORDER_BOOK_BOOK_CPU"))
+    {
+        auto idle_s = std::getenv("ORDER_BOOK_IDLE");
+        std::string idle{idle_s ? idle_s : "pause"};
+        book_thread = std::make_unique<BookThread>(loop, book_cpu, 
+          idle == "spin" ? BookThread::Idle::SPIN : idle == "backoff" ? 
+          BookThread::Idle::BACKOFF : BookThread::Idle::PAUSE, make_book);
+    }
+    else
+    {
+        parser = make_book();
+    }
+    auto& order_book = book_thread ? book_thread->parser() : *parser;
+
+    // ORDER_BOOK_PERF=1 reads the hardware counters around each phase of 
+    //  every command and prints the per-command averages on QUIT. This 
+    //  thread's counters: not with a book thread.
+    const std::vector<std::string> commands{"CREATE", "DELETE", "MODIFY", "GET",
+      "AGGREGATED_BEST", "SWEEP", "MASS_DELETE", "HANDOFF_OUT", "HANDOFF_IN", 
+      "CREATE_AUTO", "TRADE", "BARS", "TRADES", "OTHER"};
+    std::unique_ptr<PerfCounters> counters;
+    std::unique_ptr<PhaseProfile> profile;
+    if (std::getenv("ORDER_BOOK_PERF") && !book_thread)
+    {
+        counters = std::make_unique<PerfCounters>();
+        profile = std::make_unique<PhaseProfile>(commands, 
+          std::vector<std::string>{"parse", "apply", "respond"});
+    }
+
+    // ORDER_BOOK_LOG=file logs every book mutation, binary (see log_decode).
+    //  ORDER_BOOK_LOG_SYNC=1 makes it a journal: fdatasync'd, by group commit.
+    if (auto log_file = std::getenv("ORDER_BOOK_LOG"))
+    {
+        Logger::instance().open(log_file, true, 
+          std::getenv("ORDER_BOOK_LOG_SYNC") != nullptr);
+    }
+
+    // Built with -DORDER_BOOK_TRACE: stage stamps of every command, decoded 
+    //  offline by trace_decode.
+    TRACE_OPEN("order_book.trace");
+
+    // No argument: TCP clients on port 8080 (ORDER_BOOK_PORT: another port,
+    //  or a Unix socket path), a session each, until killed. Otherwise: the 
+    //  console, until QUIT or the end of stdin. Same sessions on the same 
+    //  loop either way.
+    Frontend frontend{order_book, commands, counters.get(), profile.get(), 
+      book_thread.get()};
+    // Expiry and checkpoints without commands too: an idle server still 
+    //  drops its expired orders (from the shared depth and the followers as
+    //  well). A book thread does its own between jobs.
+    std::unique_ptr<Timer> timer;
+    if (!book_thread)
+    {
+        timer = std::make_unique<Timer>(loop, housekeeping_period_ns);
+        housekeeping(frontend, *timer);
+    }
+    // The backlog is the queue of clients not accepted yet.
+    constexpr int backlog = 128;
+
+    // Hot standby (see replication_log.hpp).
+    // ORDER_BOOK_REPLICATION=port|/path: followers connect there and get 
+    //  every mutation of this book.
+    // ORDER_BOOK_FOLLOW=port|/path: follows the leader there, serving reads 
+    //  only; takes over (all commands) as soon as the leader is gone. Both
+    //  together: a chain, this follower's own followers included.
+    // Both on the event loop's thread, with the book: not with a book thread.
+    if (book_thread && (std::getenv("ORDER_BOOK_REPLICATION") || 
+      std::getenv("ORDER_BOOK_FOLLOW")))
+    {
+        std::cerr << "ORDER_BOOK_BOOK_CPU: no replication, the book must be "
+          "on the event loop's thread\n";
+        return 1;
+    }
+    std::unique_ptr<ReplicationLog> replication;
+    std::unique_ptr<Listener> replication_listener;
+    if (auto address = std::getenv("ORDER_BOOK_REPLICATION"))
+    {
+        replication = std::make_unique<ReplicationLog>(loop);
+        order_book.book().attach_replication(replication.get());
+        replication_listener = std::make_unique<Listener>(loop, address, 
+          backlog);
+        accept_followers(loop, *replication_listener, order_book.book(), 
+          *replication);
+    }
+    if (auto leader = std::getenv("ORDER_BOOK_FOLLOW"))
+    {
+        frontend.following = true;
+        follow(loop, frontend, leader);
+    }
+
+    std::unique_ptr<Listener> listener;
     if (argc == 1)
     {
-        network_mod();
-        return 0;
+        auto port = std::getenv("ORDER_BOOK_PORT");
+        listener = std::make_unique<Listener>(loop, port ? port : "8080", 
+          backlog);
+        accept_clients(loop, *listener, frontend);
+    }
+    else
+    {
+        session(loop, frontend, STDIN_FILENO, STDOUT_FILENO, 
+          OrderBook::no_session);
     }
+    loop.run();
+    // The last changes into the checkpoints (a book thread does its own).
+    if (!book_thread)
+    {
+        order_book.book().checkpoint(OrderBook::now_ns(), true);
+    }
+    // Stopped before the logger and the tracer it writes to.
+    book_thread.reset();
+
+    if (profile)
+    {
+        profile->report(std::cerr, *counters);
+    }
+    TRACE_CLOSE();
+    Logger::instance().close();
+
+    return 0;
+}
 
-    OrderBookParser order_book;
+// One client: reads commands line by line, replies to each. The console 
+//  (no_session) echoes the command and prompts for the next one, as a 
+//  terminal user expects; a TCP client gets only the reply, one line each.
+Task session(EventLoop& loop, Frontend& frontend, int in_fd, int out_fd, 
+  uint32_t session_id)
+{
+    const bool console = session_id == OrderBook::no_session;
+    auto& order_book = frontend.order_book;
+    auto* counters = frontend.counters;
+    PerfCounters::Sample samples[4];
+    AsyncStream stream{loop, in_fd, out_fd};
+
+    // The reply buffer, reused for every command. The few replies that
+    //  outgrow it (HANDOFF_OUT, very long IDs) go on in the spill string.
+    char reply_data[4096];
+    std::string reply_spill;
+    OutputBuffer reply{reply_data, sizeof(reply_data), &reply_spill};
+    std::string input;
+    std::string command;
+    std::string parameters;
+    BookThread::Job job{&command, &parameters, &reply, session_id};
 
     while (true)
     {
-        std::cout << "Insert COMMAND: " ;
-        
-        std::string input;
-        std::getline(std::cin, input);
+        if (console)
+        {
+            stream.write("Insert COMMAND: ");
+        }
+
+        // Replies go out only when there's no more input to process: a 
+        //  client that pipelines commands gets its replies in one write.
+        bool more = true;
+        while (more && !stream.getline(input))
+        {
+            more = co_await stream.flush() && co_await stream.read();
+        }
+        if (!more)
+        {
+            break;
+        }
+        // Traced from the moment the line is there: the wait for it is the
+        //  client's, and other sessions run meanwhile.
+        TRACE_BEGIN(++frontend.request);
+        TRACE_STAGE(TraceStage::READ);
+
+        if (counters)
+        {
+            counters->read(samples[0]);
+        }
         std::stringstream ss{input};
-        std::string command;
         std::getline(ss, command, ' ');
-        std::string parameters;
+        parameters.clear();
         std::getline(ss, parameters);
+        if (counters)
+        {
+            counters->read(samples[1]);
+        }
+
+        if (command == "QUIT")
+        {
+            break;
+        }
 
-        if (command == "CREATE")
+        // Good-till-time orders due by now go first, a bounded batch per 
+        //  command: a mass expiry never holds up a command for long. A 
+        //  follower gets its expiries from the leader; a book thread does 
+        //  its own. Then a checkpoint, if one is due. Both run on a timer
+        //  too, see housekeeping().
+        if (!frontend.following && !frontend.book_thread)
         {
-            std::cout << "  Command: " << command << "\n";
-            std::cout << "  Parameters: " << parameters << "\n";
+            auto now = OrderBook::now_ns();
+            order_book.book().expire(now, expire_batch);
+            order_book.book().checkpoint(now);
+        }
 
-            auto result = order_book.create(parameters);
-            std::cout << "  Result of CREATE: " << result << "\n";
+        // E.g.: CREATE 1 1 BUY 1 1, MODIFY 1 2 2, GET 1, AGGREGATED_BEST 1,
+        //  SWEEP 1 BUY 10, MASS_DELETE 1, CREATE_AUTO 1 BUY 1 1, TRADE 1 10 5,
+        //  BARS 1 60000, TRADES 1.
+        reply.clear();
+        if (frontend.following && command != "GET" && 
+          command != "AGGREGATED_BEST" && command != "SWEEP" && 
+          command != "BARS" && command != "TRADES")
+        {
+            // Only the leader changes the book.
+            reply.append("ERROR");
+        }
+        else if (frontend.book_thread)
+        {
+            job.request = frontend.request;
+            co_await frontend.book_thread->submit(job);
+        }
+        else
+        {
+            order_book.set_session(session_id);
+            // Last resort: what the book still throws (e.g. bad_alloc) fails
+            //  this command, not every session of the server.
+            try
+            {
+                order_book.dispatch(command, parameters, reply);
+            }
+            catch (const std::exception&)
+            {
+                reply.clear();
+                reply.append("ERROR");
+            }
         }
-        else if (command == "DELETE")
+        if (counters)
         {
-            // DELETE OrderId
-            std::cout << "  Command: " << command << "\n";
-            std::cout << "  Parameters: " << parameters << "\n";
+            counters->read(samples[2]);
+        }
 
-            auto result = order_book.del(parameters);
-            std::cout << "  Result of DELETE: " << result << "\n";
+        if (console)
+        {
+            stream.write("  Command: ");
+            stream.write(command);
+            stream.write("\n  Parameters: ");
+            stream.write(parameters);
+            stream.write("\n  Result of ");
+            stream.write(command);
+            stream.write(": ");
         }
-        else if (command == "MODIFY")
+        stream.write(reply.view());
+        stream.write("\n");
+        TRACE_STAGE(TraceStage::REPLIED);
+
+        if (counters)
         {
-            // MODIFY OrderId Price Quantity
-            //  E.g.: MODIFY 1 2 2
-            std::cout << "  Command: " << command << "\n";
-            std::cout << "  Parameters: " << parameters << "\n";
+            counters->read(samples[3]);
+            const auto& commands = frontend.commands;
+            auto operation = std::find(commands.begin(), commands.end() - 1, 
+              command) - commands.begin();
+            for (size_t phase = 0; phase < 3; phase++)
+            {
+                frontend.profile->add(operation, phase, samples[phase], 
+                  samples[phase + 1]);
+            }
+            frontend.profile->count(operation);
+        }
+    }
+    co_await stream.flush();
 
-            auto result = order_book.modify(parameters);
-            std::cout << "  Result of MODIFY: " << result << "\n";
-        }   
-        else if (command == "GET")
+    if (console)
+    {
+        loop.stop();
+    }
+    else
+    {
+        // Cancel on disconnect: a client that's gone can't manage its orders.
+        if (frontend.book_thread)
+        {
+            job.command = nullptr;
+            co_await frontend.book_thread->submit(job);
+        }
+        else
         {
-            // GET OrderId
-            std::cout << "  Command: " << command << "\n";
-            std::cout << "  Parameters: " << parameters << "\n";
+            order_book.cancel_session(session_id);
+        }
+        frontend.free_sessions.push_back(session_id);
+    }
+}
 
-            auto result = order_book.get(parameters);
-            std::cout << "  Result of GET: " << result << "\n";
+// Every tick, as before a command: a batch of due good-till-time orders, and
+//  a checkpoint if one is due. Not on a follower, its book is the leader's.
+Task housekeeping(Frontend& frontend, Timer& timer)
+{
+    auto& book = frontend.order_book.book();
+    while (co_await timer.tick())
+    {
+        if (!frontend.following)
+        {
+            auto now = OrderBook::now_ns();
+            book.expire(now, expire_batch);
+            book.checkpoint(now);
         }
-        else if (command == "AGGREGATED_BEST")
+    }
+}
+
+Task accept_clients(EventLoop& loop, Listener& listener, Frontend& frontend)
+{
+    while (true)
+    {
+        auto client_fd = co_await listener.accept();
+        if (client_fd < 0)
         {
-            // AGGREGATED_BEST ProductId
-            std::cout << "  Command: " << command << "\n";
-            std::cout << "  Parameters: " << parameters << "\n";
+            std::cerr << "accept() failed: " << std::strerror(errno) << "\n";
+            continue;
+        }
 
-            auto result = order_book.aggregated_best(parameters);
-            std::cout << "  Result of AGGREGATED_BEST: " << result << "\n";
+        uint32_t session_id;
+        if (frontend.free_sessions.empty())
+        {
+            session_id = frontend.next_session++;
         }
-        else if (command == "QUIT")
+        else
         {
-            break;
+            session_id = frontend.free_sessions.back();
+            frontend.free_sessions.pop_back();
         }
+        // Runs until its first wait, then comes back here.
+        session(loop, frontend, client_fd, client_fd, session_id);
     }
+}
 
-    return 0;
+// Leader side of one follower: its SYNC, then a catch-up or a snapshot, then 
+//  the records as they come, until it's gone or too far behind.
+Task serve_follower(EventLoop& loop, OrderBook& order_book, 
+  ReplicationLog& replication, int fd)
+{
+    AsyncStream stream{loop, fd, fd};
+    std::string input;
+    bool more = true;
+    while (more && !stream.getline(input))
+    {
+        more = co_await stream.read();
+    }
+    std::istringstream ss{input};
+    std::string sync;
+    uint64_t epoch = 0;
+    uint64_t sequence = 0;
+    if (!more || !(ss >> sync >> epoch >> sequence) || sync != "SYNC")
+    {
+        co_return;
+    }
+
+    std::string output;
+    if (!replication.catch_up(epoch, sequence, output))
+    {
+        // The book as of the current sequence: the records after it follow.
+        output = "SNAPSHOT " + std::to_string(replication.epoch()) + " " + 
+          std::to_string(replication.sequence()) + "\n";
+        const auto now = OrderBook::now_ns();
+        char line_data[256];
+        order_book.for_each_order([&](const Order& order, uint64_t expires_ns)
+        {
+            OutputBuffer line{line_data, sizeof(line_data)};
+            order.to_chars(line);
+            if (expires_ns != 0)
+            {
+                line.append(' ');
+                line.append(expires_ns > now ? 
+                  (expires_ns - now + 999'999) / 1'000'000 : uint64_t{0});
+            }
+            line.append('\n');
+            output += line.view();
+        });
+        output += "END\n";
+    }
+    stream.write(output);
+    output = std::string{};
+
+    // No co_await since the snapshot or the catch-up: nothing is missed.
+    ReplicationLog::Follower follower;
+    replication.add(follower);
+    while (co_await stream.flush())
+    {
+        co_await replication.wait(follower);
+        if (follower.dropped)
+        {
+            break;
+        }
+        stream.write(follower.pending);
+        follower.pending.clear();
+    }
+    replication.remove(follower);
 }
 
-void network_mod(int client_fd)
+Task accept_followers(EventLoop& loop, Listener& listener, 
+  OrderBook& order_book, ReplicationLog& replication)
 {
-    // Parameters:
-    // 1. the domain of addresses, like IPv4, IPv6, local sockets;
-    // 2. the transport layer, like TCP, UDP or raw;
-    // 3. the protocol, like TCP/IP, UDP/IP or let-the-system-decide (0).
-    // Paramer #3 allows custom protocol still based on known IP/TCP/UDP.
-    auto socket_fd = socket(AF_INET, SOCK_STREAM, 0); // IPv4/TCP.
-    // TODO: Check the File Descriptor is not -1.
-
-    // Parameters:
-    // 1. the socker File Descriptor;
-    // 2. the socket address struct;
-    // 3. the length of the socket address struct.
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY; // Any address.
-    address.sin_port = htons(8080); // From Machine to Network byte order.
-    auto result_bind = bind(socket_fd, (struct sockaddr*) &address, sizeof(address));
-    // TODO: check the bind didn't fail.
-
-    // Parameters:
-    // 1. the socket to listen on;
-    // 2. the backlog i.e. queue size of pending clients (tipically 5-128).
-    constexpr int backlog = 10;
-    auto result_listen = listen(socket_fd, backlog);
-
-    struct sockaddr_in client_address;
-    socklen_t client_address_size = sizeof(client_address);
     while (true)
     {
-        auto client_fd = accept(socket_fd, (struct sockaddr*) &client_address, 
-          &client_address_size);
-        // TODO: Check client_fd not <0.
+        auto fd = co_await listener.accept();
+        if (fd < 0)
+        {
+            std::cerr << "accept() failed: " << std::strerror(errno) << "\n";
+            continue;
+        }
+        serve_follower(loop, order_book, replication, fd);
+    }
+}
+
+// Follower side: replays the leader's records, resyncing when the connection
+//  breaks, and takes over as soon as the leader can't be reached (or breaks 
+//  the connection before syncing it).
+Task follow(EventLoop& loop, Frontend& frontend, std::string leader)
+{
+    auto& order_book = frontend.order_book;
+    uint64_t epoch = 0;
+    uint64_t sequence = 0;
+    std::string input;
+    std::string command;
+    std::string parameters;
+    char reply_data[4096];
+    OutputBuffer reply{reply_data, sizeof(reply_data)};
+    std::vector<std::string> orderIDs;
 
-        // Handle client 
-        //read()/recv() - Read data from client
-        //write()/send() - Send data to client
+    bool synced = true;
+    while (synced)
+    {
+        auto fd = connect_local(loop, leader);
+        if (fd < 0)
+        {
+            break;
+        }
+        AsyncStream stream{loop, fd, fd};
+        stream.write("SYNC " + std::to_string(epoch) + " " + 
+          std::to_string(sequence) + "\n");
+        synced = false;
+        bool snapshot = false;
+        bool more = co_await stream.flush();
+        while (more)
+        {
+            if (!stream.getline(input))
+            {
+                more = co_await stream.read();
+                continue;
+            }
 
-        // TODO:
-        // - can I make it trasparent if the I/O happens locally or via socket?
+            std::istringstream ss{input};
+            std::getline(ss, command, ' ');
+            parameters.clear();
+            std::getline(ss, parameters);
+            if (!synced)
+            {
+                // The header: SNAPSHOT or CATCHUP <epoch> <sequence>.
+                std::istringstream header{parameters};
+                if (!(header >> epoch >> sequence))
+                {
+                    break;
+                }
+                synced = true;
+                snapshot = command == "SNAPSHOT";
+                if (snapshot)
+                {
+                    orderIDs.clear();
+                    order_book.book().for_each_order(
+                      [&](const Order& order, uint64_t)
+                    {
+                        orderIDs.push_back(order.orderID);
+                    });
+                    for (const auto& orderID : orderIDs)
+                    {
+                        order_book.book().del(orderID);
+                    }
+                }
+                continue;
+            }
 
-        close(client_fd);
+            reply.clear();
+            order_book.set_session(OrderBook::no_session);
+            if (snapshot)
+            {
+                if (command == "END")
+                {
+                    snapshot = false;
+                    continue;
+                }
+                // The line is CREATE's parameters.
+                parameters = input;
+                command = "CREATE";
+            }
+            else
+            {
+                // <sequence> <COMMAND> <parameters>.
+                uint64_t next;
+                auto [end, error] = std::from_chars(command.data(), 
+                  command.data() + command.size(), next);
+                if (error != std::errc{} || 
+                  end != command.data() + command.size())
+                {
+                    // Not a line from the leader: a snapshot next time.
+                    epoch = 0;
+                    sequence = 0;
+                    break;
+                }
+                if (next != sequence + 1)
+                {
+                    break;
+                }
+                sequence++;
+                auto space = parameters.find(' ');
+                command = parameters.substr(0, space);
+                parameters.erase(0, space == std::string::npos ? 
+                  parameters.size() : space + 1);
+            }
+            try
+            {
+                order_book.dispatch(command, parameters, reply);
+            }
+            catch (const std::exception&)
+            {
+                reply.clear();
+                reply.append("ERROR");
+            }
+            if (reply.view().substr(0, 2) != "OK")
+            {
+                // Not the leader's book any more: a snapshot next time.
+                epoch = 0;
+                sequence = 0;
+                break;
+            }
+        }
     }
 
-    close(socket_fd);
-}
\ No newline at end of file
+    frontend.following = false;
+    std::cerr << "Leader " << leader << " unreachable: taking over\n";
+}
@@ -26,12 +26,141 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
+#include <set>
 #include <stdexcept>
+#include <cstring> // For memcpy().
 #include <limits> // For checking overflow.
 #include <sstream> // To build string efficiently, instead of concatenation.
 #include <shared_mutex> // For shared_mutex.
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <charconv> // For to_chars().
+#include <string_view>
+#include <tuple>
+#include <memory> // For unique_ptr.
+#include <memory_resource> // For the bounded mode's pools.
+#include "hash_functions/include/wallet/hash_functions.hpp" // SeededStringHash.
+#include "shared_book/include/shared_book/shared_book.hpp"
+#include "logger/include/logger/logger.hpp"
+#include "price_ladder/include/price_ladder/price_ladder.hpp"
+#include "arena/include/arena/arena.hpp"
+#include "timer_wheel/include/timer_wheel/timer_wheel.hpp"
+#include "replication/include/replication/replication_log.hpp"
+#include "segmented_index/include/segmented_index/segmented_index.hpp"
+#include "trade_tape/include/trade_tape/trade_tape.hpp"
+#include "checkpoint/include/checkpoint/checkpoint.hpp"
+
+
+// Caller-provided buffer for replies, e.g. one per connection, reused for 
+//  every command. Numbers go in with std::to_chars: formatting a reply doesn't
+//  allocate. What doesn't fit is cut and overflow() reports it, unless there's
+//  a 'spill' string: the reply moves there and goes on (e.g. HANDOFF_OUT, or
+//  GET with very long IDs), so a reply with no bound is never lost.
+class OutputBuffer
+{
+  public:
+    OutputBuffer(char* data, size_t capacity, std::string* spill = nullptr)
+    : m_data{data}, m_capacity{capacity}, m_buffer{data}, 
+      m_buffer_capacity{capacity}, m_spill{spill}
+    {}
 
+    void append(std::string_view text)
+    {
+        reserve(text.size());
+        auto size = std::min(text.size(), m_capacity - m_size);
+        std::memcpy(m_data + m_size, text.data(), size);
+        m_size += size;
+        m_overflow |= size < text.size();
+    }
+    void append(char c)
+    {
+        reserve(1);
+        if (m_size == m_capacity)
+        {
+            m_overflow = true;
+            return;
+        }
+        m_data[m_size++] = c;
+    }
+    void append(uint64_t value)
+    {
+        reserve(std::numeric_limits<uint64_t>::digits10 + 1);
+        auto [end, error] = std::to_chars(m_data + m_size, m_data + m_capacity,
+          value);
+        if (error != std::errc{})
+        {
+            m_overflow = true;
+            return;
+        }
+        m_size = end - m_data;
+    }
+    void append(double value, int precision)
+    {
+        auto result = std::to_chars(m_data + m_size, m_data + m_capacity,
+          value, std::chars_format::fixed, precision);
+        if (result.ec != std::errc{} && m_spill != nullptr)
+        {
+            reserve(std::numeric_limits<double>::max_exponent10 + 3 + 
+              precision);
+            result = std::to_chars(m_data + m_size, m_data + m_capacity, value,
+              std::chars_format::fixed, precision);
+        }
+        if (result.ec != std::errc{})
+        {
+            m_overflow = true;
+            return;
+        }
+        m_size = result.ptr - m_data;
+    }
+
+    std::string_view view() const
+    {
+        return {m_data, m_size};
+    }
+    bool overflow() const
+    {
+        return m_overflow;
+    }
+    void clear()
+    {
+        m_data = m_buffer;
+        m_capacity = m_buffer_capacity;
+        m_size = 0;
+        m_overflow = false;
+        m_spilled = false;
+    }
+
+  private:
+    char* m_data;
+    size_t m_capacity;
+    size_t m_size{0};
+    bool m_overflow{false};
+    // The caller's buffer, and the spill string once the reply moved there.
+    char* m_buffer;
+    size_t m_buffer_capacity;
+    std::string* m_spill;
+    bool m_spilled{false};
+
+    // Room for 'size' more bytes: in the spill string if they don't fit.
+    void reserve(size_t size)
+    {
+        if (m_size + size <= m_capacity || m_spill == nullptr)
+        {
+            return;
+        }
+        if (!m_spilled)
+        {
+            m_spill->assign(m_data, m_size);
+            m_spilled = true;
+        }
+        m_capacity = std::max(2 * m_capacity, m_size + size);
+        m_spill->resize(m_capacity);
+        m_data = m_spill->data();
+    }
+};
 
 struct Order
 {
@@ -50,6 +179,16 @@ struct Order
     std::string to_string() const // Even better if overwrite operator<<().
     {
         // Using operator+ creates lots of temporary strings: expensive!
+        //  Format in place, then one allocation for the result.
+        char data[128];
+        OutputBuffer out{data, sizeof(data)};
+        to_chars(out);
+        if (!out.overflow())
+        {
+            return std::string{out.view()};
+        }
+
+        // Very long IDs only.
         std::ostringstream oss;
         oss << orderID << " " << productID << " " << 
           (verb == Verb::BUY ? "BUY" : "SELL")
@@ -57,251 +196,1650 @@ struct Order
 
         return oss.str();
     }
+
+    // Same text as to_string(), appended to 'out'.
+    void to_chars(OutputBuffer& out) const
+    {
+        out.append(orderID);
+        out.append(' ');
+        out.append(productID);
+        out.append(verb == Verb::BUY ? " BUY " : " SELL ");
+        out.append(uint64_t{price});
+        out.append(' ');
+        out.append(uint64_t{quantity});
+    }
 };
 
 class OrderBook
 {
   public:
+    // Keys are chosen by clients, so every table is keyed through a randomly 
+    //  seeded hash (see SeededStringHash): crafted IDs can't collide on purpose.
+    //  orderID/productID => index in the slot/product arrays below.
+    //  Nodes and buckets come from m_memory (see Limits).
+    using IndexTable = std::pmr::unordered_map<std::string, uint32_t, 
+      SeededStringHash>;
+
+    // Bounded-memory mode. Everything the book needs is reserved when it's 
+    //  built: the tables and slot arrays in an Arena (huge pages if any), 
+    //  with a pool recycling the table nodes, and every product's ladders. 
+    //  After that no command allocates (handoffs excepted); one that would 
+    //  need more than the limits is rejected, i.e. it returns false.
+    struct Limits
+    {
+        size_t max_orders;
+        size_t max_products;
+        size_t max_levels; // Ticks per side of a product, i.e. the price 
+                           //  range a side can span (see PriceLadder).
+        size_t max_sessions{64}; // Highest session ID accepted.
+    };
+    // IDs must fit std::string's inline buffer (libstdc++), longer ones would
+    //  allocate: in bounded mode they're rejected.
+    static constexpr size_t bounded_max_id_length{15};
+
+    OrderBook();
+    explicit OrderBook(const Limits& limits);
+    bool bounded() const
+    {
+        return m_bounded;
+    }
+    // Bounded mode only: whether the arena got huge pages.
+    bool huge_pages() const
+    {
+        return m_arena && m_arena->huge_pages();
+    }
+
+    // Collision-chain monitoring. A table whose chain grows past 
+    //  max_chain_length is rebuilt with a fresh seed: with ~1 key per bucket 
+    //  an honest chain that long is vanishingly unlikely.
+    struct ChainStats
+    {
+        size_t longest_chain{0}; // Longest chain seen on insert.
+        size_t reseeds{0};
+    };
+    static constexpr size_t max_chain_length{16};
+
+    // Numeric order IDs ("1", "42": digits, no leading zero) up to 'max_id' go
+    //  in a direct index (see SegmentedIndex) instead of the table: no hash
+    //  on create, and GET, DELETE and MODIFY of such an order are an indexed
+    //  load. Other IDs stay in the table, as do numeric ones the bounded mode
+    //  has no room for in the index (its segments are reserved here).
+    //  Only on an empty book: false otherwise.
+    bool index_numeric_ids(uint64_t max_id = max_numeric_id);
+    // Caps the index's segment table (8 MiB of pointers at most).
+    static constexpr uint64_t max_numeric_id{
+      std::numeric_limits<uint32_t>::max()};
+
+    // Orders can belong to a client session (e.g. a connection), so that they
+    //  can be cancelled together when it goes away. IDs are the front end's, 
+    //  small and dense.
+    static constexpr uint32_t no_session{0};
+
     // CRUD operations.
+    // expires_ns: good-till-time, on now_ns()'s clock; 0 means good till 
+    //  cancelled. Expired orders go away in expire().
     bool create(const std::string& orderID, const std::string& productID, 
-      const Order::Verb verb, const uint32_t price, const uint32_t quantity);
+      const Order::Verb verb, const uint32_t price, const uint32_t quantity, 
+      const uint64_t expires_ns = 0, const uint32_t session = no_session);
+    // The book chooses the ID, numeric, in 'orderID': past every numeric ID 
+    //  it has seen (from create() too), so it can't clash with a client's.
+    //  False once past max_auto_id (e.g. a client took 9999999999999999999).
+    bool create_auto(const std::string& productID, const Order::Verb verb, 
+      const uint32_t price, const uint32_t quantity, std::string& orderID, 
+      const uint64_t expires_ns = 0, const uint32_t session = no_session);
     bool del(const std::string& orderID);
     bool modify(const std::string& orderID, const uint32_t price, 
       const uint32_t quantity);
-    const Order& get(const std::string& orderID); // Make it return bool.
+    // Orders aren't stored as Order any more (see OrderHot/OrderCold): the 
+    //  caller's Order is filled in. Reusing the same one across calls reuses 
+    //  its strings' capacity.
+    bool get(const std::string& orderID, Order& order) const;
     bool aggregated_best(const std::string& productID, uint32_t& bid_quantity, 
       uint32_t& bid_price, uint32_t& ask_quantity, uint32_t& ask_price);
+    // Pre-trade check: what a BUY (SELL) of 'quantity' would take from the 
+    //  asks (bids) right now, from the touch outwards. Nothing is changed.
+    //  False if the product is unknown or that side is empty.
+    bool sweep(const std::string& productID, const Order::Verb verb, 
+      const uint32_t quantity, PriceLadder::Sweep& sweep) const;
+
+    // Product handoff between shards (see ConsistentRing): the source book 
+    //  extracts all the orders of a product in one go, the destination inserts
+    //  them in one go, levels are rebuilt on the way in. 'expires_ns' goes
+    //  with the orders, one each: when it expires, as in create().
+    std::vector<Order> extract_product(const std::string& productID, 
+      std::vector<uint64_t>& expires_ns);
+    bool insert_product(const std::vector<Order>& product_orders, 
+      const std::vector<uint64_t>& expires_ns);
+
+    // Bulk cancels. Each one walks its own list of orders (no lookup to find 
+    //  them) and publishes every product it touched once, at the end.
+    // All the orders of a product: its price levels go whole, not order by
+    //  order. False if the product is unknown.
+    bool mass_delete(const std::string& productID, size_t& deleted);
+    // All the orders of a session, e.g. when its connection drops. Returns 
+    //  how many.
+    size_t cancel_session(uint32_t session);
+
+    // Deletes up to max_orders orders whose expiry time is <= now (as DELETE
+    //  would, logged as EXPIRE). Meant to run between commands: a mass expiry
+    //  is spread over several calls, each one bounded. Returns how many.
+    size_t expire(uint64_t now, size_t max_orders);
+    // Expired orders still waiting for expire(), as of the last call.
+    bool expiries_pending() const
+    {
+        return m_expiries.has_expired();
+    }
+
+    // The book's clock (steady_clock, ns): expiry times are on it.
+    static uint64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    // Wall clock (system_clock, ns since the epoch): trades are on it, so
+    //  that bars line up with the calendar.
+    static uint64_t wall_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Trade tapes, one per product (see TradeTape): none until enable_tape().
+    //  A product's tape is allocated on its first trade; in bounded mode
+    //  every product's is allocated here. False if 'config' has no interval,
+    //  a zero one, or no bars.
+    bool enable_tape(const TradeTape::Config& config = {});
+    // A trade of 'productID', e.g. as reported by the matching engine: onto
+    //  the product's tape and bars. False without tapes, for a quantity of 0,
+    //  or if the bounded mode has no room for a new product.
+    bool trade(const std::string& productID, const uint32_t price, 
+      const uint32_t quantity, const uint64_t time_ns);
+    // nullptr if the product never traded (or there are no tapes).
+    const TradeTape* tape(const std::string& productID) const;
+
+    const ChainStats& chain_stats() const
+    {
+        return m_chain_stats;
+    }
+
+    // Optional: after every change the product's top levels are copied into 
+    //  the shared memory segment for local readers. nullptr to detach.
+    void attach_shared_book(SharedBookWriter* shared_book)
+    {
+        m_shared_book = shared_book;
+    }
+
+    // Optional: every accepted mutation is recorded for the hot-standby 
+    //  followers (see replication_log.hpp). nullptr to detach.
+    void attach_replication(ReplicationLog* replication)
+    {
+        m_replication = replication;
+    }
+    // Optional: checkpoints of the book into 'checkpoints' (see 
+    //  checkpoint.hpp), by checkpoint(). From now on the orders and levels 
+    //  that change are tracked, for the deltas. nullptr to detach.
+    void attach_checkpoints(CheckpointFile* checkpoints);
+    // A checkpoint if one is due (or 'force'), e.g. between commands: the 
+    //  whole book the first time, then what changed since the last one. 
+    //  Returns whether one was due.
+    bool checkpoint(uint64_t now, bool force = false);
+    // The book of a recovered checkpoint (CheckpointFile::open()), orders in
+    //  the same slots so that the next deltas follow on. Levels are taken as
+    //  they are, not added up again order by order. Orders come back without
+    //  a session. Only on an empty book, before attach_checkpoints(): false 
+    //  otherwise, or if the bounded mode has no room for it.
+    bool restore(const CheckpointImage& image);
+
+    // Every order, and when it expires (now_ns()'s clock, 0 if never): e.g.
+    //  for a follower's snapshot.
+    template <typename Visit>
+    void for_each_order(Visit&& visit) const;
 
   private:
-    std::unordered_map<std::string, Order> orders;
-    // Maps productID => {price, tot_quantity}.
-    //  The key value is const by default in map.
-    std::unordered_map<std::string, std::map<uint32_t, uint32_t>> bids;
-    std::unordered_map<std::string, std::map<uint32_t, uint32_t>> asks;
+    // Orders are split by access pattern (Structure of Arrays) and share a 
+    //  slot index: m_hot[slot] and m_cold[slot] are the same order.
+    // Hot: everything DELETE/MODIFY read or write. 16 bytes, 4 per cache line,
+    //  and no strings: the orderID is only needed to find the slot, the 
+    //  productID is interned into an index.
+    struct OrderHot
+    {
+        uint32_t price;
+        uint32_t quantity;
+        uint32_t product; // Index in m_products.
+        Order::Verb verb;
+    };
+    static_assert(sizeof(OrderHot) == 16);
+    // Cold: only GET and the handoffs read it.
+    struct OrderCold
+    {
+        std::string orderID;
+        uint64_t created_ns;
+        uint64_t modified_ns;
+    };
+    static constexpr uint32_t no_slot{std::numeric_limits<uint32_t>::max()};
+    // The order's place in its product's list and in its session's list: 
+    //  doubly linked through slots, so that unlinking is O(1) and a bulk 
+    //  cancel needs no lookup.
+    struct OrderLinks
+    {
+        uint32_t product_prev;
+        uint32_t product_next;
+        uint32_t session_prev;
+        uint32_t session_next;
+        uint32_t session;
+    };
+    struct Product
+    {
+        std::string productID;
+        PriceLadder bids;
+        PriceLadder asks;
+        uint32_t orders{no_slot}; // First of the list.
+        bool touched{false}; // In m_touched.
+        // Checkpoints: prices changed since the last one, per side (bids, 
+        //  asks). A side with more than max_dirty_levels goes whole.
+        std::vector<uint32_t> dirty_levels[2];
+        bool dirty_whole[2]{false, false};
+        bool dirty{false}; // In m_dirty_products.
+    };
+    static constexpr size_t max_dirty_levels{64};
+    // Per slot, for the checkpoints.
+    enum SlotFlags : uint8_t
+    {
+        slot_dirty = 1, // In m_dirty_slots.
+        slot_saved = 2, // The checkpoints have an order in it.
+        slot_new = 4 // Not that one: a new order since the last checkpoint.
+    };
+
+    // Bounded mode only: arena => monotonic resource (no upstream: nothing 
+    //  ever comes from the heap) => pool. Declared first, the tables below 
+    //  live in them.
+    bool m_bounded{false};
+    Limits m_limits{};
+    std::unique_ptr<Arena> m_arena;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> m_arena_resource;
+    std::unique_ptr<std::pmr::unsynchronized_pool_resource> m_pool;
+    // The pool, or new/delete when unbounded.
+    std::pmr::memory_resource* m_memory;
+
+    IndexTable orders;
+    // Numeric orderIDs => slot, when enabled (see index_numeric_ids()).
+    SegmentedIndex m_numeric_ids;
+    // Numeric IDs it would take but that went to 'orders' (no segment left):
+    //  while there are none, a miss in the index needs no table lookup.
+    size_t m_spilled{0};
+    // create_auto()'s next ID, max_auto_id + 1 when they're used up.
+    uint64_t m_next_id{1};
+    // 19 digits: the longest numeric ID (see SegmentedIndex::parse()).
+    static constexpr uint64_t max_auto_id{9'999'999'999'999'999'999ull};
+    std::pmr::vector<OrderHot> m_hot;
+    std::pmr::vector<OrderCold> m_cold;
+    std::pmr::vector<OrderLinks> m_links;
+    // Slots of deleted orders, for reuse.
+    std::pmr::vector<uint32_t> m_free_slots;
+    // Products are interned on first use and never removed: there are few.
+    //  In bounded mode all of them are built upfront, m_product_index.size() 
+    //  are in use.
+    IndexTable m_product_index;
+    std::pmr::vector<Product> m_products;
+    // Session => first order of its list, no_slot if none.
+    std::pmr::vector<uint32_t> m_sessions;
+    // Products to publish at the end of a bulk cancel.
+    std::pmr::vector<uint32_t> m_touched;
+    // Product => its tape, nullptr before its first trade.
+    bool m_tapes_enabled{false};
+    TradeTape::Config m_tape_config;
+    std::vector<std::unique_ptr<TradeTape>> m_tapes;
+    // Good-till-time orders, by slot. 1 ms ticks.
+    TimerWheel m_expiries{1'000'000, now_ns()};
+    ChainStats m_chain_stats;
+    SharedBookWriter* m_shared_book{nullptr};
+    ReplicationLog* m_replication{nullptr};
+    // Checkpoints, when attached: what changed since the last one. Products 
+    //  interned since then are those from m_saved_products on.
+    CheckpointFile* m_checkpoints{nullptr};
+    std::pmr::vector<uint8_t> m_slot_flags;
+    std::pmr::vector<uint32_t> m_dirty_slots;
+    std::pmr::vector<uint32_t> m_dirty_products;
+    size_t m_saved_products{0};
+    uint64_t m_saved_next_id{1};
+    // Reused by every checkpoint.
+    std::string m_checkpoint_buffer;
+    std::vector<uint32_t> m_level_prices;
+    std::vector<uint32_t> m_level_quantities;
     // Mutex made mutable, so it can be used in read-only methods.
     mutable std::shared_mutex m_shared_mutex; 
 
-    void increase_quantity(const Order& order, 
-      std::unordered_map<std::string, std::map<uint32_t, uint32_t>>& to_update);
-    void decrease_quantity(const Order& order, 
-      std::unordered_map<std::string, std::map<uint32_t, uint32_t>>& to_update);
+    PriceLadder& levels(const OrderHot& order)
+    {
+        auto& product = m_products[order.product];
+        return order.verb == Order::Verb::BUY ? product.bids : product.asks;
+    }
+    void increase_quantity(const OrderHot& order);
+    void decrease_quantity(const OrderHot& order);
+    // Checkpoints: no-ops unless attached.
+    void mark_slot(uint32_t slot)
+    {
+        if (m_checkpoints == nullptr || (m_slot_flags[slot] & slot_dirty))
+        {
+            return;
+        }
+        m_slot_flags[slot] |= slot_dirty;
+        m_dirty_slots.push_back(slot);
+    }
+    Product& mark_product(uint32_t product);
+    void mark_level(const OrderHot& order);
+    void mark_ladders(uint32_t product);
+    void encode_ladder(CheckpointEncoder& encoder, uint32_t product, 
+      bool buy);
+    void encode_checkpoint(std::string& out, uint64_t sequence, bool base);
+    size_t order_count() const
+    {
+        return orders.size() + m_numeric_ids.size();
+    }
+    // Bounded mode: whether one more order fits. Always true otherwise.
+    bool admits(const std::string& orderID) const
+    {
+        return !m_bounded || (order_count() < m_limits.max_orders && 
+          orderID.size() <= bounded_max_id_length);
+    }
+    bool admits(const std::vector<Order>& product_orders) const;
+    static constexpr uint32_t no_product{std::numeric_limits<uint32_t>::max()};
+    // no_product if the bounded mode has no room for a new one.
+    uint32_t intern_product(const std::string& productID);
+    uint32_t allocate_slot();
+    void release_slot(uint32_t slot);
+    void fill_order(uint32_t slot, Order& order) const;
+    // The order as a CREATE record, with the lifetime it has left if any.
+    void replicate_create(uint32_t slot, const std::string& productID);
+    template <typename Table>
+    void check_chain(Table& table, const std::string& key);
+    void publish(uint32_t product);
+    // orderID => slot through the index or the table; no_slot if unknown.
+    uint32_t find_order(const std::string& orderID) const;
+    void index_order(const std::string& orderID, uint32_t slot);
+    // Before release_slot(): the orderID is still there.
+    void unindex_order(uint32_t slot);
+    void erase_order(uint32_t slot);
+    void link_order(uint32_t slot, uint32_t session);
+    void unlink_product(uint32_t slot);
+    void unlink_session(uint32_t slot);
+    static size_t arena_bytes(const Limits& limits);
 };
 
-void OrderBook::increase_quantity(const Order& order, 
-      std::unordered_map<std::string, std::map<uint32_t, uint32_t>>& to_update)
+OrderBook::OrderBook()
+: m_memory{std::pmr::new_delete_resource()}, orders{m_memory}, 
+  m_hot{m_memory}, m_cold{m_memory}, m_links{m_memory}, 
+  m_free_slots{m_memory}, m_product_index{m_memory}, m_products{m_memory}, 
+  m_sessions{m_memory}, m_touched{m_memory}, m_slot_flags{m_memory}, 
+  m_dirty_slots{m_memory}, m_dirty_products{m_memory}
+{
+}
+
+OrderBook::OrderBook(const Limits& limits)
+: m_bounded{true}, m_limits{limits}, 
+  m_arena{std::make_unique<Arena>(arena_bytes(limits))}, 
+  m_arena_resource{std::make_unique<std::pmr::monotonic_buffer_resource>(
+    m_arena->data(), m_arena->size(), std::pmr::null_memory_resource())}, 
+  m_pool{std::make_unique<std::pmr::unsynchronized_pool_resource>(
+    m_arena_resource.get())}, 
+  m_memory{m_pool.get()}, orders{m_memory}, m_hot{m_memory}, 
+  m_cold{m_memory}, m_links{m_memory}, m_free_slots{m_memory}, 
+  m_product_index{m_memory}, m_products{m_memory}, m_sessions{m_memory}, 
+  m_touched{m_memory}, m_slot_flags{m_memory}, m_dirty_slots{m_memory}, 
+  m_dirty_products{m_memory}
 {
-    auto& prices = to_update[order.productID];
+    // No rehash below the limits.
+    orders.reserve(limits.max_orders);
+    m_product_index.reserve(limits.max_products);
+    m_hot.reserve(limits.max_orders);
+    m_cold.reserve(limits.max_orders);
+    m_links.reserve(limits.max_orders);
+    m_slot_flags.reserve(limits.max_orders);
+    m_free_slots.reserve(limits.max_orders);
+    m_sessions.resize(limits.max_sessions + 1, no_slot);
+    m_touched.reserve(limits.max_products);
+    m_expiries.reserve(limits.max_orders);
 
-    if (std::numeric_limits<uint32_t>::max() - prices[order.price] < 
-      order.quantity)
+    m_products.resize(limits.max_products);
+    for (auto& product : m_products)
     {
-        throw std::out_of_range{"Quantity overflow."};
+        product.productID.reserve(bounded_max_id_length);
+        product.bids.reserve_fixed(limits.max_levels);
+        product.asks.reserve_fixed(limits.max_levels);
     }
-    prices[order.price] += order.quantity;
 }
-void OrderBook::decrease_quantity(const Order& order, 
-      std::unordered_map<std::string, std::map<uint32_t, uint32_t>>& to_update)
+
+// Generous: running out means a rejected order, not a crash, but it shouldn't
+//  happen below the limits.
+size_t OrderBook::arena_bytes(const Limits& limits)
 {
-    auto it_product = to_update.find(order.productID);
-    if (it_product == to_update.end())
+    const size_t keys = limits.max_orders + limits.max_products;
+    // Table nodes (next, key, value, cached hash), twice for the pool's chunks.
+    size_t bytes = keys * 2 * 64;
+    // Bucket arrays: up to twice the keys (prime rounding), once plus two 
+    //  reseeds.
+    bytes += keys * 2 * sizeof(void*) * 3;
+    bytes += limits.max_orders * (sizeof(OrderHot) + sizeof(OrderCold) + 
+      sizeof(OrderLinks) + sizeof(uint8_t) + 2 * sizeof(uint32_t));
+    bytes += limits.max_products * (sizeof(Product) + 2 * sizeof(uint32_t));
+    bytes += (limits.max_sessions + 1) * sizeof(uint32_t);
+    // Pool bookkeeping.
+    return bytes + (1 << 20);
+}
+
+// Called after inserting 'key': the length of its bucket is the chain a lookup
+//  for it has to walk.
+template <typename Table>
+void OrderBook::check_chain(Table& table, const std::string& key)
+{
+    auto chain = table.bucket_size(table.bucket(key));
+    m_chain_stats.longest_chain = std::max(m_chain_stats.longest_chain, chain);
+    if (chain <= max_chain_length)
+    {
+        return;
+    }
+
+    // Move the nodes (no copy, no allocation per entry) into a table hashed 
+    //  with a new seed: the crafted keys spread out again.
+    // In bounded mode the new bucket array comes out of the arena's slack: 
+    //  once that's gone the table keeps its seed.
+    try
     {
-        throw std::out_of_range{"ProductID doesn't exist."};
+        Table reseeded(table.bucket_count(), 
+          SeededStringHash{SeededStringHash::random_seed()}, 
+          typename Table::key_equal{}, table.get_allocator());
+        reseeded.max_load_factor(table.max_load_factor());
+        while (!table.empty())
+        {
+            reseeded.insert(table.extract(table.begin()));
+        }
+        table.swap(reseeded);
+        m_chain_stats.reseeds += 1;
     }
+    catch (const std::bad_alloc&)
+    {
+    }
+}
 
-    auto& prices = it_product->second;
-    auto it_price = prices.find(order.price);
-    if (it_price == prices.end())
+void OrderBook::publish(uint32_t product)
+{
+    if (m_shared_book == nullptr)
     {
-        throw std::out_of_range{"Price doesn't exist."};
+        return;
     }
 
-    auto& quantity = it_price->second;
-    quantity -= order.quantity;
-    if (quantity == 0) // It won't never be <0.
+    // Best first on both sides: bids from the highest price, asks from the 
+    //  lowest.
+    const auto& entry = m_products[product];
+    uint32_t prices[SharedProduct::depth];
+    uint32_t quantities[SharedProduct::depth];
+    SharedLevel bid_levels[SharedProduct::depth];
+    SharedLevel ask_levels[SharedProduct::depth];
+
+    auto bid_count = entry.bids.best_levels(true, prices, quantities, 
+      SharedProduct::depth);
+    for (size_t i = 0; i < bid_count; i++)
+    {
+        bid_levels[i] = {prices[i], quantities[i]};
+    }
+    auto ask_count = entry.asks.best_levels(false, prices, quantities, 
+      SharedProduct::depth);
+    for (size_t i = 0; i < ask_count; i++)
     {
-        prices.erase(it_price);
+        ask_levels[i] = {prices[i], quantities[i]};
     }
+
+    m_shared_book->publish(entry.productID, bid_levels, bid_count, ask_levels, 
+      ask_count);
 }
 
-bool OrderBook::create(const std::string& orderID, const std::string& productID, 
-  const Order::Verb verb, const uint32_t price, const uint32_t quantity)
+uint32_t OrderBook::intern_product(const std::string& productID)
+{
+    auto it = m_product_index.find(productID);
+    if (it != m_product_index.end())
+    {
+        return it->second;
+    }
+
+    uint32_t product = m_product_index.size();
+    if (m_bounded)
+    {
+        if (product == m_limits.max_products || 
+          productID.size() > bounded_max_id_length)
+        {
+            return no_product;
+        }
+    }
+    else
+    {
+        m_products.emplace_back();
+    }
+    m_products[product].productID = productID;
+    m_product_index.emplace(productID, product);
+    check_chain(m_product_index, productID);
+    return product;
+}
+
+// Bounded mode: all or nothing for a whole handoff. Handoffs are rare, this 
+//  check may allocate.
+bool OrderBook::admits(const std::vector<Order>& product_orders) const
+{
+    if (!m_bounded)
+    {
+        return true;
+    }
+    if (order_count() + product_orders.size() > m_limits.max_orders)
+    {
+        return false;
+    }
+
+    // productID, verb => lowest, highest price.
+    std::map<std::pair<std::string, Order::Verb>, 
+      std::pair<uint32_t, uint32_t>> spans;
+    std::set<std::string> new_products;
+    for (const auto& order : product_orders)
+    {
+        if (order.orderID.size() > bounded_max_id_length || 
+          order.productID.size() > bounded_max_id_length)
+        {
+            return false;
+        }
+        auto [it, inserted] = spans.try_emplace({order.productID, order.verb}, 
+          order.price, order.price);
+        it->second.first = std::min(it->second.first, order.price);
+        it->second.second = std::max(it->second.second, order.price);
+        if (m_product_index.find(order.productID) == m_product_index.end())
+        {
+            new_products.insert(order.productID);
+        }
+    }
+    if (m_product_index.size() + new_products.size() > m_limits.max_products)
+    {
+        return false;
+    }
+
+    for (const auto& [key, span] : spans)
+    {
+        auto it = m_product_index.find(key.first);
+        // A new product gets an unused one: an empty ladder like all the rest.
+        const auto& product = m_products[it != m_product_index.end() ? 
+          it->second : m_product_index.size()];
+        const auto& ladder = key.second == Order::Verb::BUY ? product.bids : 
+          product.asks;
+        if (!ladder.accepts(span.first, span.second))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t OrderBook::allocate_slot()
 {
-    // TODO:
-    // - limits the number of orders.
+    if (!m_free_slots.empty())
+    {
+        auto slot = m_free_slots.back();
+        m_free_slots.pop_back();
+        m_slot_flags[slot] |= slot_new;
+        mark_slot(slot);
+        return slot;
+    }
+    m_hot.emplace_back();
+    m_cold.emplace_back();
+    m_links.emplace_back();
+    m_slot_flags.emplace_back(slot_new);
+    mark_slot(m_hot.size() - 1);
+    return m_hot.size() - 1;
+}
 
-    if (orders.find(orderID) != orders.end())
+void OrderBook::release_slot(uint32_t slot)
+{
+    // The orderID keeps its capacity for the next order in this slot.
+    m_cold[slot].orderID.clear();
+    m_free_slots.push_back(slot);
+    mark_slot(slot);
+}
+
+bool OrderBook::index_numeric_ids(uint64_t max_id)
+{
+    if (order_count() != 0)
     {
         return false;
     }
+    max_id = std::min(max_id, max_numeric_id);
+    // Bounded: enough segments for the limit's orders twice over, i.e. for
+    //  live IDs spread over twice their number. Beyond that, the table.
+    m_numeric_ids = m_bounded ? SegmentedIndex{max_id, 2 * (
+      m_limits.max_orders / SegmentedIndex::segment_size + 1), true} : 
+      SegmentedIndex{max_id};
+    return true;
+}
+
+uint32_t OrderBook::find_order(const std::string& orderID) const
+{
+    static_assert(no_slot == SegmentedIndex::none);
+    uint64_t id;
+    if (m_numeric_ids.fits(orderID, id))
+    {
+        auto slot = m_numeric_ids.find(id);
+        if (slot != no_slot || m_spilled == 0)
+        {
+            return slot;
+        }
+    }
+    auto it = orders.find(orderID);
+    return it == orders.end() ? no_slot : it->second;
+}
+
+void OrderBook::index_order(const std::string& orderID, uint32_t slot)
+{
+    uint64_t id;
+    if (m_numeric_ids.fits(orderID, id))
+    {
+        if (m_numeric_ids.insert(id, slot))
+        {
+            return;
+        }
+        m_spilled += 1;
+    }
+    orders[orderID] = slot;
+    check_chain(orders, orderID);
+}
+
+void OrderBook::unindex_order(uint32_t slot)
+{
+    const auto& orderID = m_cold[slot].orderID;
+    uint64_t id;
+    if (m_numeric_ids.fits(orderID, id))
+    {
+        if (m_numeric_ids.find(id) == slot)
+        {
+            m_numeric_ids.erase(id);
+            return;
+        }
+        m_spilled -= 1;
+    }
+    orders.erase(orderID);
+}
+
+void OrderBook::fill_order(uint32_t slot, Order& order) const
+{
+    const auto& hot = m_hot[slot];
+    order.orderID = m_cold[slot].orderID;
+    order.productID = m_products[hot.product].productID;
+    order.verb = hot.verb;
+    order.price = hot.price;
+    order.quantity = hot.quantity;
+}
+void OrderBook::replicate_create(uint32_t slot, 
+  const std::string& productID)
+{
+    const auto& hot = m_hot[slot];
+    const auto& orderID = m_cold[slot].orderID;
+    auto verb = hot.verb == Order::Verb::BUY ? "BUY" : "SELL";
+    if (!m_expiries.scheduled(slot))
+    {
+        m_replication->record("CREATE", orderID, productID, verb, hot.price, 
+          hot.quantity);
+        return;
+    }
+    // Rounded up: the follower's copy never expires before the leader's.
+    auto deadline = m_expiries.deadline_ns(slot);
+    auto now = now_ns();
+    uint64_t lifetime_ms = deadline > now ? (deadline - now + 999'999) / 
+      1'000'000 : 0;
+    m_replication->record("CREATE", orderID, productID, verb, hot.price, 
+      hot.quantity, lifetime_ms);
+}
+template <typename Visit>
+void OrderBook::for_each_order(Visit&& visit) const
+{
+    // Through the products' lists: both indexes at once.
+    Order order;
+    for (const auto& product : m_products)
+    {
+        for (auto slot = product.orders; slot != no_slot; 
+          slot = m_links[slot].product_next)
+        {
+            fill_order(slot, order);
+            visit(order, m_expiries.scheduled(slot) ? 
+              m_expiries.deadline_ns(slot) : 0);
+        }
+    }
+}
+
+// Both throw std::out_of_range, see PriceLadder.
+void OrderBook::increase_quantity(const OrderHot& order)
+{
+    levels(order).add(order.price, order.quantity);
+    mark_level(order);
+}
+void OrderBook::decrease_quantity(const OrderHot& order)
+{
+    levels(order).remove(order.price, order.quantity);
+    mark_level(order);
+}
+
+bool OrderBook::create(const std::string& orderID, const std::string& productID, 
+  const Order::Verb verb, const uint32_t price, const uint32_t quantity, 
+  const uint64_t expires_ns, const uint32_t session)
+{
+    if (find_order(orderID) != no_slot)
+    {
+        LOG(LogFormat::CREATE, orderID, productID, price, quantity, false);
+        return false;
+    }
     if (orderID == "" || productID == "")
     {
+        LOG(LogFormat::CREATE, orderID, productID, price, quantity, false);
         return false;
     }
 
-    Order new_order;
-    new_order.orderID = orderID;
-    new_order.productID = productID;
-    new_order.verb = verb;
-    new_order.price = price;
-    new_order.quantity = quantity;
+    // Sessions: unbounded mode grows the table, bounded mode has a limit.
+    if (session >= m_sessions.size())
+    {
+        if (m_bounded)
+        {
+            LOG(LogFormat::CREATE, orderID, productID, price, quantity, false);
+            return false;
+        }
+        m_sessions.resize(session + 1, no_slot);
+    }
 
-    orders[orderID] = new_order;
+    // Limits of the bounded mode, and the level's total must fit 32 bits.
+    auto product = admits(orderID) ? intern_product(productID) : no_product;
+    const auto* ladder = product == no_product ? nullptr : 
+      verb == Order::Verb::BUY ? &m_products[product].bids : 
+      &m_products[product].asks;
+    if (ladder == nullptr || !ladder->accepts(price, price) || 
+      std::numeric_limits<uint32_t>::max() - ladder->quantity(price) < 
+      quantity)
+    {
+        LOG(LogFormat::CREATE, orderID, productID, price, quantity, false);
+        return false;
+    }
+
+    auto slot = allocate_slot();
+    auto& hot = m_hot[slot];
+    hot.price = price;
+    hot.quantity = quantity;
+    hot.product = product;
+    hot.verb = verb;
+    auto& cold = m_cold[slot];
+    cold.orderID = orderID;
+    cold.created_ns = cold.modified_ns = now_ns();
+
+    index_order(orderID, slot);
+    link_order(slot, session);
+    if (expires_ns != 0)
+    {
+        m_expiries.schedule(slot, expires_ns);
+    }
 
     // Increase bids OR asks.
-    if (new_order.verb == Order::Verb::BUY)
+    increase_quantity(hot);
+    publish(hot.product);
+    LOG(LogFormat::CREATE, orderID, productID, price, quantity, true);
+    if (m_replication)
     {
-        increase_quantity(new_order, bids);
+        replicate_create(slot, productID);
     }
-    else
+
+    // create_auto() goes on past it: a numeric ID is max_auto_id at most, 
+    //  so m_next_id is max_auto_id + 1 at most.
+    uint64_t id;
+    if (SegmentedIndex::parse(orderID, id) && id >= m_next_id)
     {
-        increase_quantity(new_order, asks);
+        m_next_id = id + 1;
     }
     
     return true;
 }
+bool OrderBook::create_auto(const std::string& productID, 
+  const Order::Verb verb, const uint32_t price, const uint32_t quantity, 
+  std::string& orderID, const uint64_t expires_ns, const uint32_t session)
+{
+    if (m_next_id > max_auto_id)
+    {
+        LOG(LogFormat::CREATE, orderID, productID, price, quantity, false);
+        return false;
+    }
+    char data[24];
+    auto [end, error] = std::to_chars(data, data + sizeof(data), m_next_id);
+    if (error != std::errc{})
+    {
+        return false;
+    }
+    orderID.assign(data, end);
+    const auto id = m_next_id;
+    if (!create(orderID, productID, verb, price, quantity, expires_ns, 
+      session))
+    {
+        return false;
+    }
+    m_next_id = std::max(m_next_id, id + 1);
+    return true;
+}
 bool OrderBook::del(const std::string& orderID)
 {
-    auto it = orders.find(orderID);
-    if (it == orders.end())
+    auto slot = find_order(orderID);
+    if (slot == no_slot)
     {
+        LOG(LogFormat::DELETE, orderID, false);
         return false;
     }
 
+    erase_order(slot);
+    LOG(LogFormat::DELETE, orderID, true);
+    if (m_replication)
+    {
+        m_replication->record("DELETE", orderID);
+    }
+
+    return true;
+}
+void OrderBook::erase_order(uint32_t slot)
+{
     // Decrease bids OR asks.
-    if (it->second.verb == Order::Verb::BUY)
+    decrease_quantity(m_hot[slot]);
+    publish(m_hot[slot].product);
+
+    unlink_product(slot);
+    unlink_session(slot);
+    m_expiries.cancel(slot);
+    unindex_order(slot);
+    release_slot(slot);
+}
+void OrderBook::link_order(uint32_t slot, uint32_t session)
+{
+    auto& links = m_links[slot];
+    auto& product = m_products[m_hot[slot].product];
+    links.product_prev = no_slot;
+    links.product_next = product.orders;
+    if (product.orders != no_slot)
+    {
+        m_links[product.orders].product_prev = slot;
+    }
+    product.orders = slot;
+
+    links.session = session;
+    if (session == no_session)
+    {
+        return;
+    }
+    links.session_prev = no_slot;
+    links.session_next = m_sessions[session];
+    if (m_sessions[session] != no_slot)
     {
-        decrease_quantity(it->second, bids);
+        m_links[m_sessions[session]].session_prev = slot;
+    }
+    m_sessions[session] = slot;
+}
+void OrderBook::unlink_product(uint32_t slot)
+{
+    const auto& links = m_links[slot];
+    if (links.product_prev != no_slot)
+    {
+        m_links[links.product_prev].product_next = links.product_next;
     }
     else
     {
-        decrease_quantity(it->second, asks);
+        m_products[m_hot[slot].product].orders = links.product_next;
+    }
+    if (links.product_next != no_slot)
+    {
+        m_links[links.product_next].product_prev = links.product_prev;
+    }
+}
+void OrderBook::unlink_session(uint32_t slot)
+{
+    const auto& links = m_links[slot];
+    if (links.session == no_session)
+    {
+        return;
+    }
+    if (links.session_prev != no_slot)
+    {
+        m_links[links.session_prev].session_next = links.session_next;
+    }
+    else
+    {
+        m_sessions[links.session] = links.session_next;
+    }
+    if (links.session_next != no_slot)
+    {
+        m_links[links.session_next].session_prev = links.session_prev;
+    }
+}
+bool OrderBook::mass_delete(const std::string& productID, size_t& deleted)
+{
+    deleted = 0;
+    auto it_product = m_product_index.find(productID);
+    if (it_product == m_product_index.end())
+    {
+        LOG(LogFormat::MASS_DELETE, productID, deleted);
+        return false;
+    }
+    auto& product = m_products[it_product->second];
+
+    // The product's list goes whole: only the session lists need unlinking.
+    for (auto slot = product.orders; slot != no_slot; deleted++)
+    {
+        auto next = m_links[slot].product_next;
+        unlink_session(slot);
+        m_expiries.cancel(slot);
+        unindex_order(slot);
+        release_slot(slot);
+        slot = next;
     }
+    product.orders = no_slot;
 
-    orders.erase(it);
+    // Whole ladders go at once, no per-order decrease_quantity().
+    product.bids.clear();
+    product.asks.clear();
+    mark_ladders(it_product->second);
+    publish(it_product->second);
+    LOG(LogFormat::MASS_DELETE, productID, deleted);
+    if (m_replication)
+    {
+        m_replication->record("MASS_DELETE", productID);
+    }
 
     return true;
 }
+size_t OrderBook::cancel_session(uint32_t session)
+{
+    if (session == no_session || session >= m_sessions.size())
+    {
+        return 0;
+    }
+
+    // Levels are shared with other sessions: decreased order by order, but 
+    //  each product is published once.
+    size_t cancelled = 0;
+    for (auto slot = m_sessions[session]; slot != no_slot; cancelled++)
+    {
+        auto next = m_links[slot].session_next;
+        const auto& hot = m_hot[slot];
+        decrease_quantity(hot);
+        auto& product = m_products[hot.product];
+        if (!product.touched)
+        {
+            product.touched = true;
+            m_touched.push_back(hot.product);
+        }
+        unlink_product(slot);
+        m_expiries.cancel(slot);
+        // Followers have no sessions: they get the orders' deletes.
+        if (m_replication)
+        {
+            m_replication->record("DELETE", m_cold[slot].orderID);
+        }
+        unindex_order(slot);
+        release_slot(slot);
+        slot = next;
+    }
+    m_sessions[session] = no_slot;
+
+    for (auto product : m_touched)
+    {
+        m_products[product].touched = false;
+        publish(product);
+    }
+    m_touched.clear();
+    LOG(LogFormat::CANCEL_SESSION, session, cancelled);
+
+    return cancelled;
+}
+size_t OrderBook::expire(uint64_t now, size_t max_orders)
+{
+    m_expiries.advance(now);
+
+    size_t expired = 0;
+    uint32_t slots[64];
+    while (expired < max_orders)
+    {
+        auto count = m_expiries.pop_expired(slots, 
+          std::min(max_orders - expired, std::size(slots)));
+        if (count == 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto& orderID = m_cold[slots[i]].orderID;
+            LOG(LogFormat::EXPIRE, orderID);
+            // Followers don't expire anything themselves: they follow.
+            if (m_replication)
+            {
+                m_replication->record("DELETE", orderID);
+            }
+            erase_order(slots[i]);
+        }
+        expired += count;
+    }
+
+    return expired;
+}
 bool OrderBook::modify(const std::string& orderID, const uint32_t price, 
   const uint32_t quantity)
 {
-    if (orders.find(orderID) == orders.end())
+    auto slot = find_order(orderID);
+    if (slot == no_slot)
     {
+        LOG(LogFormat::MODIFY, orderID, price, quantity, false);
         return false;
     }
 
-    auto& order = orders[orderID];
+    auto& order = m_hot[slot];
 
     if (price == order.price && quantity == order.quantity)
     {
+        LOG(LogFormat::MODIFY, orderID, price, quantity, true);
         return true;
     }
-
-    // Decrease bids OR asks.
-    if (order.verb == Order::Verb::BUY)
+    // Bounded mode: the new price must fit the ladder. Conservative, the 
+    //  order's current level still counts. Then the new level's total must 
+    //  fit 32 bits: checked now, before the order leaves its level.
+    auto& ladder = levels(order);
+    uint64_t total = uint64_t{ladder.quantity(price)} + quantity - 
+      (price == order.price ? order.quantity : 0);
+    if (!ladder.accepts(price, price) || 
+      total > std::numeric_limits<uint32_t>::max())
     {
-        decrease_quantity(order, bids);
-    }
-    else
-    {
-        decrease_quantity(order, asks);
+        LOG(LogFormat::MODIFY, orderID, price, quantity, false);
+        return false;
     }
 
+    // Decrease bids OR asks.
+    decrease_quantity(order);
+
     // Finally update order.
     order.price = price;
     order.quantity = quantity;
+    m_cold[slot].modified_ns = now_ns();
+    mark_slot(slot);
 
     // Increase bids OR asks.
-    if (order.verb == Order::Verb::BUY)
+    increase_quantity(order);
+    publish(order.product);
+    LOG(LogFormat::MODIFY, orderID, price, quantity, true);
+    if (m_replication)
     {
-        increase_quantity(order, bids);
+        m_replication->record("MODIFY", orderID, price, quantity);
     }
-    else
+
+    return true;
+}
+bool OrderBook::get(const std::string& orderID, Order& order) const
+{
+    auto slot = find_order(orderID);
+    if (slot == no_slot)
     {
-        increase_quantity(order, asks);
+        return false;
     }
 
+    fill_order(slot, order);
     return true;
 }
-const Order& OrderBook::get(const std::string& orderID)
+bool OrderBook::enable_tape(const TradeTape::Config& config)
 {
-    auto it = orders.find(orderID);
-    if (it == orders.end())
+    if (config.intervals_ns.empty() || config.bars == 0 || 
+      std::find(config.intervals_ns.begin(), config.intervals_ns.end(), 0) !=
+      config.intervals_ns.end())
+    {
+        return false;
+    }
+    m_tapes_enabled = true;
+    m_tape_config = config;
+    m_tapes.clear();
+    if (m_bounded)
+    {
+        m_tapes.resize(m_limits.max_products);
+        for (auto& tape : m_tapes)
+        {
+            tape = std::make_unique<TradeTape>(config);
+        }
+    }
+    return true;
+}
+bool OrderBook::trade(const std::string& productID, const uint32_t price, 
+  const uint32_t quantity, const uint64_t time_ns)
+{
+    auto product = m_tapes_enabled && quantity != 0 && productID != "" ? 
+      intern_product(productID) : no_product;
+    if (product == no_product)
+    {
+        LOG(LogFormat::TRADE, productID, price, quantity, false);
+        return false;
+    }
+
+    if (product >= m_tapes.size())
+    {
+        m_tapes.resize(product + 1);
+    }
+    auto& tape = m_tapes[product];
+    if (!tape)
+    {
+        tape = std::make_unique<TradeTape>(m_tape_config);
+    }
+    tape->add({time_ns, price, quantity});
+    LOG(LogFormat::TRADE, productID, price, quantity, true);
+    // The follower's bars get its own clock's time, close to the leader's.
+    if (m_replication)
     {
-        throw std::out_of_range{"orderID doesn't exist!"};
+        m_replication->record("TRADE", productID, price, quantity);
     }
 
-    return it->second;
+    return true;
+}
+const TradeTape* OrderBook::tape(const std::string& productID) const
+{
+    auto it_product = m_product_index.find(productID);
+    if (it_product == m_product_index.end() || 
+      it_product->second >= m_tapes.size())
+    {
+        return nullptr;
+    }
+    return m_tapes[it_product->second].get();
+}
+void OrderBook::attach_checkpoints(CheckpointFile* checkpoints)
+{
+    m_checkpoints = checkpoints;
+    // Bounded: room for everything a checkpoint can have to track, now.
+    if (m_bounded && checkpoints != nullptr)
+    {
+        m_dirty_slots.reserve(m_limits.max_orders);
+        m_dirty_products.reserve(m_limits.max_products);
+        for (auto& product : m_products)
+        {
+            product.dirty_levels[0].reserve(max_dirty_levels);
+            product.dirty_levels[1].reserve(max_dirty_levels);
+        }
+        m_level_prices.reserve(m_limits.max_levels);
+        m_level_quantities.reserve(m_limits.max_levels);
+    }
+}
+OrderBook::Product& OrderBook::mark_product(uint32_t product)
+{
+    auto& entry = m_products[product];
+    if (!entry.dirty)
+    {
+        entry.dirty = true;
+        m_dirty_products.push_back(product);
+    }
+    return entry;
+}
+void OrderBook::mark_level(const OrderHot& order)
+{
+    if (m_checkpoints == nullptr)
+    {
+        return;
+    }
+    auto& product = mark_product(order.product);
+    auto side = order.verb == Order::Verb::BUY ? 0 : 1;
+    auto& prices = product.dirty_levels[side];
+    // The same level again and again (e.g. a MODIFY of the quantity) is
+    //  caught here, the other repeats when the checkpoint sorts them.
+    if (product.dirty_whole[side] || (!prices.empty() && 
+      prices.back() == order.price))
+    {
+        return;
+    }
+    if (prices.size() == max_dirty_levels)
+    {
+        product.dirty_whole[side] = true;
+        return;
+    }
+    prices.push_back(order.price);
+}
+void OrderBook::mark_ladders(uint32_t product)
+{
+    if (m_checkpoints == nullptr)
+    {
+        return;
+    }
+    auto& entry = mark_product(product);
+    entry.dirty_whole[0] = entry.dirty_whole[1] = true;
+}
+void OrderBook::encode_ladder(CheckpointEncoder& encoder, uint32_t product, 
+  bool buy)
+{
+    const auto& ladder = buy ? m_products[product].bids : 
+      m_products[product].asks;
+    m_level_prices.resize(ladder.levels());
+    m_level_quantities.resize(ladder.levels());
+    auto count = ladder.best_levels(false, m_level_prices.data(), 
+      m_level_quantities.data(), ladder.levels());
+    encoder.ladder(product, buy, true);
+    for (size_t i = 0; i < count; i++)
+    {
+        encoder.level(m_level_prices[i], m_level_quantities[i]);
+    }
+}
+void OrderBook::encode_checkpoint(std::string& out, uint64_t sequence, 
+  bool base)
+{
+    CheckpointEncoder encoder{out, base ? CheckpointKind::BASE : 
+      CheckpointKind::DELTA, sequence};
+    if (base || m_next_id != m_saved_next_id)
+    {
+        encoder.next_id(m_next_id);
+        m_saved_next_id = m_next_id;
+    }
+    const size_t products = m_product_index.size();
+    for (size_t product = base ? 0 : m_saved_products; product < products; 
+      product++)
+    {
+        encoder.product(product, m_products[product].productID);
+    }
+    m_saved_products = products;
+
+    // Levels: all of them in a base, those that changed in a delta.
+    for (size_t product = 0; base && product < products; product++)
+    {
+        for (auto buy : {true, false})
+        {
+            if (!(buy ? m_products[product].bids : 
+              m_products[product].asks).empty())
+            {
+                encode_ladder(encoder, product, buy);
+            }
+        }
+    }
+    for (auto product : m_dirty_products)
+    {
+        auto& entry = m_products[product];
+        for (int side = 0; side < 2; side++)
+        {
+            auto& prices = entry.dirty_levels[side];
+            if (!base && entry.dirty_whole[side])
+            {
+                encode_ladder(encoder, product, side == 0);
+            }
+            else if (!base && !prices.empty())
+            {
+                std::sort(prices.begin(), prices.end());
+                prices.erase(std::unique(prices.begin(), prices.end()), 
+                  prices.end());
+                const auto& ladder = side == 0 ? entry.bids : entry.asks;
+                encoder.ladder(product, side == 0, false);
+                for (auto price : prices)
+                {
+                    encoder.level(price, ladder.quantity(price));
+                }
+            }
+            prices.clear();
+            entry.dirty_whole[side] = false;
+        }
+        entry.dirty = false;
+    }
+    m_dirty_products.clear();
+
+    // Orders: every one in a base; in a delta, a slot that changed has a new
+    //  order, a modified one, or none any more. Deadlines go on the wall 
+    //  clock, the steady one starts over with the process.
+    const auto now = now_ns();
+    const auto wall_now = wall_ns();
+    auto save = [&](uint32_t slot)
+      {
+          auto& flags = m_slot_flags[slot];
+          const auto& hot = m_hot[slot];
+          const auto& orderID = m_cold[slot].orderID;
+          if (!orderID.empty() && (flags & slot_saved) && 
+            !(flags & slot_new))
+          {
+              encoder.modify(slot, hot.price, hot.quantity);
+          }
+          else if (!orderID.empty())
+          {
+              uint64_t expires_ms = 0;
+              if (m_expiries.scheduled(slot))
+              {
+                  auto deadline = m_expiries.deadline_ns(slot);
+                  expires_ms = (wall_now + (deadline > now ? deadline - now : 
+                    0) + 999'999) / 1'000'000;
+              }
+              encoder.order(slot, orderID, hot.product, 
+                hot.verb == Order::Verb::BUY, hot.price, hot.quantity, 
+                expires_ms);
+          }
+          else if (flags & slot_saved)
+          {
+              encoder.erase(slot);
+          }
+          flags = orderID.empty() ? 0 : slot_saved;
+      };
+    if (base)
+    {
+        for (uint32_t slot = 0; slot < m_hot.size(); slot++)
+        {
+            m_slot_flags[slot] = 0;
+            save(slot);
+        }
+    }
+    else
+    {
+        std::sort(m_dirty_slots.begin(), m_dirty_slots.end());
+        for (auto slot : m_dirty_slots)
+        {
+            save(slot);
+        }
+    }
+    m_dirty_slots.clear();
+    encoder.finish();
+}
+bool OrderBook::checkpoint(uint64_t now, bool force)
+{
+    if (m_checkpoints == nullptr || (!force && !m_checkpoints->due(now)))
+    {
+        return false;
+    }
+    m_checkpoint_buffer.clear();
+    encode_checkpoint(m_checkpoint_buffer, m_checkpoints->next_sequence(), 
+      m_checkpoints->needs_base());
+    m_checkpoints->write(m_checkpoint_buffer, now);
+    return true;
+}
+bool OrderBook::restore(const CheckpointImage& image)
+{
+    if (m_checkpoints != nullptr || order_count() != 0 || 
+      m_product_index.size() != 0)
+    {
+        return false;
+    }
+    // The whole image is checked before the book is touched: a restore() 
+    //  that fails leaves it empty.
+    const size_t slots = image.orders.empty() ? 0 : 
+      image.orders.rbegin()->first + 1;
+    if (image.ladders.size() != image.products.size() || (m_bounded && 
+      (image.products.size() > m_limits.max_products || 
+      slots > m_limits.max_orders)))
+    {
+        return false;
+    }
+    std::unordered_set<std::string_view> names;
+    for (uint32_t product = 0; product < image.products.size(); product++)
+    {
+        const auto& productID = image.products[product];
+        if (!names.insert(productID).second || (m_bounded && 
+          productID.size() > bounded_max_id_length))
+        {
+            return false;
+        }
+        // A bounded book's ladders are all there, fixed windows: their 
+        //  levels must fit. Others take any price.
+        for (auto buy : {true, false})
+        {
+            const auto& levels = buy ? image.ladders[product].bids : 
+              image.ladders[product].asks;
+            if (m_bounded && !levels.empty() && !(buy ? 
+              m_products[product].bids : m_products[product].asks).accepts(
+              levels.begin()->first, levels.rbegin()->first))
+            {
+                return false;
+            }
+        }
+    }
+    names.clear();
+    names.reserve(image.orders.size());
+    for (const auto& [slot, order] : image.orders)
+    {
+        if (order.orderID.empty() || order.product >= image.products.size() ||
+          (m_bounded && order.orderID.size() > bounded_max_id_length) || 
+          !names.insert(order.orderID).second)
+        {
+            return false;
+        }
+    }
+
+    for (uint32_t product = 0; product < image.products.size(); product++)
+    {
+        intern_product(image.products[product]);
+        for (auto buy : {true, false})
+        {
+            auto& ladder = buy ? m_products[product].bids : 
+              m_products[product].asks;
+            const auto& levels = buy ? image.ladders[product].bids : 
+              image.ladders[product].asks;
+            for (const auto& [price, quantity] : levels)
+            {
+                ladder.add(price, quantity);
+            }
+        }
+    }
+
+    if (!m_bounded)
+    {
+        orders.reserve(image.orders.size());
+    }
+    // The slots in between are free, the lowest one reused first.
+    m_hot.resize(slots);
+    m_cold.resize(slots);
+    m_links.resize(slots);
+    m_slot_flags.resize(slots, 0);
+    auto it = image.orders.rbegin();
+    for (auto slot = slots; slot-- > 0; )
+    {
+        if (it != image.orders.rend() && it->first == slot)
+        {
+            ++it;
+            continue;
+        }
+        m_free_slots.push_back(slot);
+    }
+
+    const auto now = now_ns();
+    const auto wall_now = wall_ns();
+    for (const auto& [slot, order] : image.orders)
+    {
+        auto& hot = m_hot[slot];
+        hot.price = order.price;
+        hot.quantity = order.quantity;
+        hot.product = order.product;
+        hot.verb = order.buy ? Order::Verb::BUY : Order::Verb::SELL;
+        auto& cold = m_cold[slot];
+        cold.orderID = order.orderID;
+        cold.created_ns = cold.modified_ns = now;
+
+        index_order(order.orderID, slot);
+        link_order(slot, no_session);
+        if (order.expires_ms != 0)
+        {
+            // Already past: expires at the next expire().
+            auto expires_ns = order.expires_ms * 1'000'000;
+            m_expiries.schedule(slot, now + (expires_ns > wall_now ? 
+              expires_ns - wall_now : 0));
+        }
+        m_slot_flags[slot] = slot_saved;
+    }
+    m_next_id = m_saved_next_id = image.next_id;
+    m_saved_products = image.products.size();
+    for (uint32_t product = 0; product < image.products.size(); product++)
+    {
+        publish(product);
+    }
+
+    return true;
 }
 bool OrderBook::aggregated_best(const std::string& productID, uint32_t& bid_quantity, 
   uint32_t& bid_price, uint32_t& ask_quantity, uint32_t& ask_price)
 {
-    auto it_bid = bids.find(productID);
-    auto it_ask = asks.find(productID);
-    if (it_bid == bids.end() && it_ask == asks.end())
+    auto it_product = m_product_index.find(productID);
+    if (it_product == m_product_index.end())
+    {
+        return false;
+    }
+    const auto& product = m_products[it_product->second];
+    if (product.bids.empty() && product.asks.empty())
     {
         return false;
     }
 
-    // To buy.
-    if (it_bid == bids.end())
+    // To buy: the best bid is the highest one.
+    if (!product.bids.highest(bid_price, bid_quantity))
     {
         bid_quantity = 0;
         bid_price = 0;
     }
-    else
-    {
-        // Increasing order, so the best bid is the last one.
-        auto it_price = it_bid->second.rbegin();
-        bid_quantity = it_price->second;
-        bid_price = it_price->first;
-    }
 
-    // To sell.
-    if (it_ask == asks.end())
+    // To sell: the best ask is the lowest one.
+    if (!product.asks.lowest(ask_price, ask_quantity))
     {
         ask_quantity = 0;
         ask_price = 0;
     }
-    else
+
+    return true;
+}
+bool OrderBook::sweep(const std::string& productID, const Order::Verb verb, 
+  const uint32_t quantity, PriceLadder::Sweep& sweep) const
+{
+    auto it_product = m_product_index.find(productID);
+    if (it_product == m_product_index.end())
+    {
+        return false;
+    }
+    const auto& product = m_products[it_product->second];
+
+    // A buyer takes the asks from the lowest up, a seller the bids from the 
+    //  highest down.
+    sweep = verb == Order::Verb::BUY ? product.asks.sweep(false, quantity) : 
+      product.bids.sweep(true, quantity);
+    return sweep.levels != 0;
+}
+std::vector<Order> OrderBook::extract_product(const std::string& productID, 
+  std::vector<uint64_t>& expires_ns)
+{
+    std::vector<Order> extracted;
+    expires_ns.clear();
+    auto it_product = m_product_index.find(productID);
+    if (it_product == m_product_index.end())
+    {
+        LOG(LogFormat::HANDOFF_OUT, productID, extracted.size());
+        return extracted;
+    }
+    const auto product = it_product->second;
+
+    // The product's own list: no scan of the other products' orders.
+    for (auto slot = m_products[product].orders; slot != no_slot;)
+    {
+        auto next = m_links[slot].product_next;
+        extracted.emplace_back();
+        fill_order(slot, extracted.back());
+        expires_ns.push_back(m_expiries.scheduled(slot) ? 
+          m_expiries.deadline_ns(slot) : 0);
+        unlink_session(slot);
+        m_expiries.cancel(slot);
+        unindex_order(slot);
+        release_slot(slot);
+        slot = next;
+    }
+    m_products[product].orders = no_slot;
+
+    // Whole ladders go at once, no per-order decrease_quantity().
+    m_products[product].bids.clear();
+    m_products[product].asks.clear();
+    mark_ladders(product);
+    publish(product);
+    LOG(LogFormat::HANDOFF_OUT, productID, extracted.size());
+    if (m_replication)
     {
-        // Increasing order, so the best ask is the first one.
-        auto it_price = it_ask->second.begin();
-        ask_quantity = it_price->second;
-        ask_price = it_price->first;
+        m_replication->record("MASS_DELETE", productID);
     }
 
+    return extracted;
+}
+bool OrderBook::insert_product(const std::vector<Order>& product_orders, 
+  const std::vector<uint64_t>& expires_ns)
+{
+    // All or nothing: check every orderID, against the book and the rest of 
+    //  the handoff, and every level's new total before touching the book.
+    //  Handoffs are rare, this check may allocate.
+    std::set<std::string_view> orderIDs;
+    // productID, verb, price => quantity the handoff adds.
+    std::map<std::tuple<std::string_view, Order::Verb, uint32_t>, uint64_t> 
+      added;
+    auto valid = expires_ns.size() == product_orders.size() && 
+      admits(product_orders);
+    for (size_t i = 0; valid && i < product_orders.size(); i++)
+    {
+        const auto& order = product_orders[i];
+        valid = order.orderID != "" && order.productID != "" && 
+          find_order(order.orderID) == no_slot && 
+          orderIDs.insert(order.orderID).second;
+        added[{order.productID, order.verb, order.price}] += order.quantity;
+    }
+    for (auto it = added.begin(); valid && it != added.end(); it++)
+    {
+        const auto& [productID, verb, price] = it->first;
+        uint64_t quantity = it->second;
+        auto it_product = m_product_index.find(std::string{productID});
+        if (it_product != m_product_index.end())
+        {
+            const auto& product = m_products[it_product->second];
+            quantity += (verb == Order::Verb::BUY ? product.bids : 
+              product.asks).quantity(price);
+        }
+        valid = quantity <= std::numeric_limits<uint32_t>::max();
+    }
+    if (!valid)
+    {
+        LOG(LogFormat::HANDOFF_IN, product_orders.size(), false);
+        return false;
+    }
+
+    for (size_t i = 0; i < product_orders.size(); i++)
+    {
+        const auto& order = product_orders[i];
+        auto slot = allocate_slot();
+        auto& hot = m_hot[slot];
+        hot.price = order.price;
+        hot.quantity = order.quantity;
+        hot.product = intern_product(order.productID);
+        hot.verb = order.verb;
+        auto& cold = m_cold[slot];
+        cold.orderID = order.orderID;
+        cold.created_ns = cold.modified_ns = now_ns();
+
+        index_order(order.orderID, slot);
+        link_order(slot, no_session);
+        increase_quantity(hot);
+        if (expires_ns[i] != 0)
+        {
+            m_expiries.schedule(slot, expires_ns[i]);
+        }
+        if (m_replication)
+        {
+            replicate_create(slot, order.productID);
+        }
+
+        // A handoff is usually one product: publish each one once.
+        if (i + 1 == product_orders.size() || 
+          product_orders[i + 1].productID != order.productID)
+        {
+            publish(hot.product);
+        }
+    }
+    LOG(LogFormat::HANDOFF_IN, product_orders.size(), true);
+
     return true;
 }
 
 
+// Design sketches, not compiled.
+#if 0
 
 /*
-** LOGGING.
+** LOGGING: done, see logger/include/logger/logger.hpp.
 */
 #include <stdexcept>
-#include <iostream> // or proper logging framework
 
 class OrderBookException : public std::runtime_error {
 public:
     OrderBookException(const std::string& msg) : std::runtime_error(msg) {}
 };
 
-class OrderBook {
-private:
-    void log_operation(const std::string& operation, const std::string& orderID, bool success) {
-        // In production: use spdlog, glog, or similar
-        std::cout << "[" << get_timestamp() << "] " << operation 
-                  << " orderID=" << orderID << " success=" << success << std::endl;
-    }
-
-    std::string get_timestamp() const {
-        // Return current timestamp
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        return std::ctime(&time_t);
-    }
-};
-
 /*
 ** STATISTICS & METRICS
 */
@@ -382,4 +1920,6 @@ private:
             listener->on_order_added(order);
         }
     }
-};
\ No newline at end of file
+};
+
+#endif
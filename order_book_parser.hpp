@@ -1,39 +1,325 @@
 #pragma once
 
+#include <charconv> // For from_chars().
 #include <string>
 #include "order_book.hpp"
+#include "trace/include/trace/trace.hpp"
 
 
 class OrderBookParser
 {
   public:
-    std::string create(std::string& parameters);
-    std::string del(std::string& parameters);
-    std::string modify(std::string& parameters);
-    std::string get(std::string& parameters);
-    std::string aggregated_best(std::string& parameters);
+    OrderBookParser() = default;
+    // Bounded-memory book, see OrderBook::Limits.
+    explicit OrderBookParser(const OrderBook::Limits& limits)
+    : order_book{limits}
+    {
+    }
+
+    // Runs one command, e.g. dispatch("GET", "1"). Unknown commands: "ERROR".
+    std::string dispatch(const std::string& command, std::string& parameters);
+    // Same, appending the reply to the caller's buffer: no allocation for the
+    //  reply (HANDOFF_OUT/HANDOFF_IN excepted, they're rare and unbounded).
+    //  Give 'out' a spill string if a reply must never be cut: HANDOFF_OUT's
+    //  product is gone from the book by the time its reply is written.
+    void dispatch(const std::string& command, std::string& parameters, 
+      OutputBuffer& out);
+
+    void create(std::string& parameters, OutputBuffer& out);
+    void create_auto(std::string& parameters, OutputBuffer& out);
+    void del(std::string& parameters, OutputBuffer& out);
+    void modify(std::string& parameters, OutputBuffer& out);
+    void get(std::string& parameters, OutputBuffer& out);
+    void aggregated_best(std::string& parameters, OutputBuffer& out);
+    void sweep(std::string& parameters, OutputBuffer& out);
+    void mass_delete(std::string& parameters, OutputBuffer& out);
+    void trade(std::string& parameters, OutputBuffer& out);
+    void bars(std::string& parameters, OutputBuffer& out);
+    void trades(std::string& parameters, OutputBuffer& out);
+
+    // String replies: formatted in a stack buffer, then one std::string.
+    std::string create(std::string& parameters)
+    {
+        return reply(&OrderBookParser::create, parameters);
+    }
+    std::string create_auto(std::string& parameters)
+    {
+        return reply(&OrderBookParser::create_auto, parameters);
+    }
+    std::string del(std::string& parameters)
+    {
+        return reply(&OrderBookParser::del, parameters);
+    }
+    std::string modify(std::string& parameters)
+    {
+        return reply(&OrderBookParser::modify, parameters);
+    }
+    std::string get(std::string& parameters)
+    {
+        return reply(&OrderBookParser::get, parameters);
+    }
+    std::string aggregated_best(std::string& parameters)
+    {
+        return reply(&OrderBookParser::aggregated_best, parameters);
+    }
+    std::string sweep(std::string& parameters)
+    {
+        return reply(&OrderBookParser::sweep, parameters);
+    }
+    std::string mass_delete(std::string& parameters)
+    {
+        return reply(&OrderBookParser::mass_delete, parameters);
+    }
+    std::string trade(std::string& parameters)
+    {
+        return reply(&OrderBookParser::trade, parameters);
+    }
+    std::string bars(std::string& parameters)
+    {
+        return reply(&OrderBookParser::bars, parameters);
+    }
+    std::string trades(std::string& parameters)
+    {
+        return reply(&OrderBookParser::trades, parameters);
+    }
+    std::string handoff_out(std::string& parameters);
+    std::string handoff_in(std::string& parameters);
+
+    // Session the next CREATEs belong to, set by the front end per client; 
+    //  OrderBook::no_session by default.
+    void set_session(uint32_t session)
+    {
+        m_session = session;
+    }
+    // E.g. when the client's connection drops. Returns how many orders.
+    size_t cancel_session(uint32_t session)
+    {
+        return order_book.cancel_session(session);
+    }
+
+    // Direct access, for setup (e.g. attach_shared_book()) and benchmarks.
+    OrderBook& book()
+    {
+        return order_book;
+    }
 
   private:
     OrderBook order_book;
+    Order m_order; // Filled by GET, its strings' capacity is reused.
+    std::string m_auto_id; // Filled by CREATE_AUTO, same.
+    uint32_t m_session{OrderBook::no_session};
+
+    static constexpr size_t reply_capacity{256};
+    // BARS and TRADES: entries per reply, at most, and a bound on the size of
+    //  one entry.
+    static constexpr size_t default_series{10};
+    static constexpr size_t max_series{16};
+    static constexpr size_t series_entry_capacity{96};
+    // A year: good-till-time, not good-till-cancelled.
+    static constexpr uint64_t max_lifetime_ms{365ull * 24 * 3600 * 1000};
+
+    std::string reply(void (OrderBookParser::*method)(std::string&, 
+      OutputBuffer&), std::string& parameters);
+
+    // 'text' is all digits and fits 'value'. No exception: a client's typo 
+    //  gets an ERROR, not the end of the server.
+    template <typename Number>
+    static bool parse(const std::string& text, Number& value)
+    {
+        auto end = text.data() + text.size();
+        auto [last, error] = std::from_chars(text.data(), end, value);
+        return !text.empty() && error == std::errc{} && last == end;
+    }
+    // [LifetimeMs] of CREATE and CREATE_AUTO: 'expires_ns' 0 if none.
+    static bool parse_lifetime(const std::string& text, uint64_t& expires_ns)
+    {
+        uint64_t lifetime_ms = 0;
+        if (!text.empty() && (!parse(text, lifetime_ms) || 
+          lifetime_ms > max_lifetime_ms))
+        {
+            return false;
+        }
+        expires_ns = text.empty() ? 0 : 
+          OrderBook::now_ns() + lifetime_ms * 1'000'000;
+        return true;
+    }
 };
 
-std::string OrderBookParser::create(std::string& parameters)
+std::string OrderBookParser::reply(void (OrderBookParser::*method)(
+  std::string&, OutputBuffer&), std::string& parameters)
+{
+    char data[reply_capacity];
+    OutputBuffer out{data, sizeof(data)};
+    (this->*method)(parameters, out);
+    if (out.overflow())
+    {
+        // Only GET with very long IDs, and BARS/TRADES, get here.
+        std::string buffer(max_series * series_entry_capacity + 
+          2 * parameters.size(), '\0');
+        OutputBuffer retry{buffer.data(), buffer.size()};
+        (this->*method)(parameters, retry);
+        buffer.resize(retry.view().size());
+        return buffer;
+    }
+    return std::string{out.view()};
+}
+
+std::string OrderBookParser::dispatch(const std::string& command, 
+  std::string& parameters)
 {
-    // CREATE OrderId ProductId Verb Price Quantity
-    //  E.g.: CREATE 1 1 BUY 1 1
+    if (command == "HANDOFF_OUT")
+    {
+        return handoff_out(parameters);
+    }
+    else if (command == "HANDOFF_IN")
+    {
+        return handoff_in(parameters);
+    }
+
+    char data[reply_capacity];
+    OutputBuffer out{data, sizeof(data)};
+    dispatch(command, parameters, out);
+    if (out.overflow())
+    {
+        if (command == "GET")
+        {
+            return get(parameters);
+        }
+        else if (command == "BARS")
+        {
+            return bars(parameters);
+        }
+        else if (command == "TRADES")
+        {
+            return trades(parameters);
+        }
+    }
+    return std::string{out.view()};
+}
+void OrderBookParser::dispatch(const std::string& command, 
+  std::string& parameters, OutputBuffer& out)
+{
+    if (command == "CREATE")
+    {
+        create(parameters, out);
+    }
+    else if (command == "CREATE_AUTO")
+    {
+        create_auto(parameters, out);
+    }
+    else if (command == "DELETE")
+    {
+        del(parameters, out);
+    }
+    else if (command == "MODIFY")
+    {
+        modify(parameters, out);
+    }
+    else if (command == "GET")
+    {
+        get(parameters, out);
+    }
+    else if (command == "AGGREGATED_BEST")
+    {
+        aggregated_best(parameters, out);
+    }
+    else if (command == "SWEEP")
+    {
+        sweep(parameters, out);
+    }
+    else if (command == "MASS_DELETE")
+    {
+        mass_delete(parameters, out);
+    }
+    else if (command == "TRADE")
+    {
+        trade(parameters, out);
+    }
+    else if (command == "BARS")
+    {
+        bars(parameters, out);
+    }
+    else if (command == "TRADES")
+    {
+        trades(parameters, out);
+    }
+    else if (command == "HANDOFF_OUT")
+    {
+        out.append(handoff_out(parameters));
+    }
+    else if (command == "HANDOFF_IN")
+    {
+        out.append(handoff_in(parameters));
+    }
+    else
+    {
+        out.append("ERROR");
+    }
+}
+void OrderBookParser::create(std::string& parameters, OutputBuffer& out)
+{
+    // CREATE OrderId ProductId Verb Price Quantity [LifetimeMs]
+    //  E.g.: CREATE 1 1 BUY 1 1, or CREATE 1 1 BUY 1 1 5000 to have it expire
+    //  after 5 s (good-till-time).
     std::stringstream ss{parameters};
-    std::string orderID, productID, verb_s, price_s, quantity_s;
+    std::string orderID, productID, verb_s, price_s, quantity_s, lifetime_s;
     std::getline(ss, orderID, ' ');
     std::getline(ss, productID, ' ');
     std::getline(ss, verb_s, ' ');
     std::getline(ss, price_s, ' ');
-    std::getline(ss, quantity_s);
+    std::getline(ss, quantity_s, ' ');
+    std::getline(ss, lifetime_s);
 
     auto verb = verb_s == "BUY" ? Order::Verb::BUY : Order::Verb::SELL;
-    return order_book.create(orderID, productID, verb, std::stoul(price_s), 
-      std::stoul(quantity_s)) ? "OK" : "ERROR";
+    uint32_t price, quantity;
+    uint64_t expires_ns;
+    if (!parse(price_s, price) || !parse(quantity_s, quantity) || 
+      !parse_lifetime(lifetime_s, expires_ns))
+    {
+        out.append("ERROR");
+        return;
+    }
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.create(orderID, productID, verb, price, quantity, 
+      expires_ns, m_session);
+    TRACE_STAGE(TraceStage::APPLIED);
+    out.append(result ? "OK" : "ERROR");
 }
-std::string OrderBookParser::del(std::string& parameters)
+void OrderBookParser::create_auto(std::string& parameters, OutputBuffer& out)
+{
+    // CREATE_AUTO ProductId Verb Price Quantity [LifetimeMs]
+    //  E.g.: CREATE_AUTO 1 BUY 1 1. The book picks the OrderId, numeric.
+    // Reply: OK: OrderId, e.g. "OK: 42".
+    std::stringstream ss{parameters};
+    std::string productID, verb_s, price_s, quantity_s, lifetime_s;
+    std::getline(ss, productID, ' ');
+    std::getline(ss, verb_s, ' ');
+    std::getline(ss, price_s, ' ');
+    std::getline(ss, quantity_s, ' ');
+    std::getline(ss, lifetime_s);
+
+    auto verb = verb_s == "BUY" ? Order::Verb::BUY : Order::Verb::SELL;
+    uint32_t price, quantity;
+    uint64_t expires_ns;
+    if (!parse(price_s, price) || !parse(quantity_s, quantity) || 
+      !parse_lifetime(lifetime_s, expires_ns))
+    {
+        out.append("ERROR");
+        return;
+    }
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.create_auto(productID, verb, price, quantity, 
+      m_auto_id, expires_ns, m_session);
+    TRACE_STAGE(TraceStage::APPLIED);
+    if (!result)
+    {
+        out.append("ERROR");
+        return;
+    }
+    out.append("OK: ");
+    out.append(m_auto_id);
+}
+void OrderBookParser::del(std::string& parameters, OutputBuffer& out)
 {
     // DELETE OrderId
     //  E.g.: DELETE 1
@@ -43,9 +329,12 @@ std::string OrderBookParser::del(std::string& parameters)
     std::string orderID;
     std::getline(ss, orderID);
 
-    return order_book.del(orderID) ? "OK" : "ERROR";
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.del(orderID);
+    TRACE_STAGE(TraceStage::APPLIED);
+    out.append(result ? "OK" : "ERROR");
 }
-std::string OrderBookParser::modify(std::string& parameters)
+void OrderBookParser::modify(std::string& parameters, OutputBuffer& out)
 {
     // MODIFY OrderId Price Quantity
     //  E.g.: MODIFY 1 2 2
@@ -56,10 +345,18 @@ std::string OrderBookParser::modify(std::string& parameters)
     std::getline(ss, price_s, ' ');
     std::getline(ss, quantity_s);
 
-    return order_book.modify(orderID, stoul(price_s), stoul(quantity_s)) ?
-      "OK" : "ERROR";
+    uint32_t price, quantity;
+    if (!parse(price_s, price) || !parse(quantity_s, quantity))
+    {
+        out.append("ERROR");
+        return;
+    }
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.modify(orderID, price, quantity);
+    TRACE_STAGE(TraceStage::APPLIED);
+    out.append(result ? "OK" : "ERROR");
 }
-std::string OrderBookParser::get(std::string& parameters)
+void OrderBookParser::get(std::string& parameters, OutputBuffer& out)
 {
     // GET OrderId
     //  E.g.: GET 1
@@ -68,19 +365,20 @@ std::string OrderBookParser::get(std::string& parameters)
     std::string orderID;
     std::getline(ss, orderID);
 
-    try
-    {
-        auto order = order_book.get(orderID);
-        return "OK: " + order.to_string();
-    }
-    catch(...)
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.get(orderID, m_order);
+    TRACE_STAGE(TraceStage::APPLIED);
+    if (!result)
     {
-
+        out.append("ERROR");
+        return;
     }
 
-    return "ERROR";
+    out.append("OK: ");
+    m_order.to_chars(out);
 }
-std::string OrderBookParser::aggregated_best(std::string& parameters)
+void OrderBookParser::aggregated_best(std::string& parameters, 
+  OutputBuffer& out)
 {
     // AGGREGATED_BEST ProductID
     //  E.g.: AGGREGATED_BEST 1
@@ -89,19 +387,295 @@ std::string OrderBookParser::aggregated_best(std::string& parameters)
     std::string productID;
     std::getline(ss, productID);
 
-    std::string to_return;
     uint32_t bid_quantity, bid_price, ask_quantity, ask_price;
-    if (order_book.aggregated_best(productID, bid_quantity, bid_price, 
-      ask_quantity, ask_price))
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.aggregated_best(productID, bid_quantity, bid_price,
+      ask_quantity, ask_price);
+    TRACE_STAGE(TraceStage::APPLIED);
+    if (result)
     {
-        to_return = "OK: "+std::to_string(bid_quantity)+"@"
-          +std::to_string(bid_price)+"|"+std::to_string(ask_quantity)+"@"
-          +std::to_string(ask_price);  
+        // No operator+ or to_string(): each number goes straight into 'out'.
+        out.append("OK: ");
+        out.append(uint64_t{bid_quantity});
+        out.append('@');
+        out.append(uint64_t{bid_price});
+        out.append('|');
+        out.append(uint64_t{ask_quantity});
+        out.append('@');
+        out.append(uint64_t{ask_price});
     }
     else
     {
-        to_return = "ERROR";
+        out.append("ERROR");
     }
+}
+void OrderBookParser::sweep(std::string& parameters, OutputBuffer& out)
+{
+    // SWEEP ProductId Verb Quantity
+    //  E.g.: SWEEP 1 BUY 100
+    // Reply: OK: Filled VWAP LastPrice Levels, e.g. "OK: 100 10.2500 11 2".
+    //  Filled is less than Quantity if the book runs out.
+
+    std::stringstream ss{parameters};
+    std::string productID, verb_s, quantity_s;
+    std::getline(ss, productID, ' ');
+    std::getline(ss, verb_s, ' ');
+    std::getline(ss, quantity_s);
 
-    return to_return;
-}
\ No newline at end of file
+    auto verb = verb_s == "BUY" ? Order::Verb::BUY : Order::Verb::SELL;
+    uint32_t quantity;
+    if (!parse(quantity_s, quantity))
+    {
+        out.append("ERROR");
+        return;
+    }
+    PriceLadder::Sweep sweep;
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.sweep(productID, verb, quantity, sweep);
+    TRACE_STAGE(TraceStage::APPLIED);
+    if (!result)
+    {
+        out.append("ERROR");
+        return;
+    }
+
+    out.append("OK: ");
+    out.append(sweep.filled);
+    out.append(' ');
+    out.append(double(sweep.cost) / double(sweep.filled), 4);
+    out.append(' ');
+    out.append(uint64_t{sweep.last_price});
+    out.append(' ');
+    out.append(uint64_t{sweep.levels});
+}
+void OrderBookParser::mass_delete(std::string& parameters, OutputBuffer& out)
+{
+    // MASS_DELETE ProductId
+    //  E.g.: MASS_DELETE 1
+    // Reply: OK: Deleted, the number of orders deleted.
+
+    std::stringstream ss{parameters};
+    std::string productID;
+    std::getline(ss, productID);
+
+    size_t deleted;
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.mass_delete(productID, deleted);
+    TRACE_STAGE(TraceStage::APPLIED);
+    if (!result)
+    {
+        out.append("ERROR");
+        return;
+    }
+
+    out.append("OK: ");
+    out.append(uint64_t{deleted});
+}
+void OrderBookParser::trade(std::string& parameters, OutputBuffer& out)
+{
+    // TRADE ProductId Price Quantity
+    //  E.g.: TRADE 1 10 5, an execution of 5 at 10, e.g. reported by the
+    //  matching engine. Timestamped on arrival.
+
+    std::stringstream ss{parameters};
+    std::string productID, price_s, quantity_s;
+    std::getline(ss, productID, ' ');
+    std::getline(ss, price_s, ' ');
+    std::getline(ss, quantity_s);
+
+    uint32_t price, quantity;
+    if (!parse(price_s, price) || !parse(quantity_s, quantity))
+    {
+        out.append("ERROR");
+        return;
+    }
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = order_book.trade(productID, price, quantity, 
+      OrderBook::wall_ns());
+    TRACE_STAGE(TraceStage::APPLIED);
+    out.append(result ? "OK" : "ERROR");
+}
+void OrderBookParser::bars(std::string& parameters, OutputBuffer& out)
+{
+    // BARS ProductId [IntervalMs [Count]]
+    //  E.g.: BARS 1, or BARS 1 60000 5 for the last 5 minute bars. By default
+    //  the first interval configured and 10 bars, 16 at most.
+    // Reply: OK: StartMs Open High Low Close Volume VWAP|..., the newest
+    //  first, e.g. "OK: 1700000060000 10 12 9 11 300 10.5000".
+
+    std::stringstream ss{parameters};
+    std::string productID, interval_s, count_s;
+    std::getline(ss, productID, ' ');
+    std::getline(ss, interval_s, ' ');
+    std::getline(ss, count_s);
+
+    size_t count = default_series;
+    uint64_t interval_ms = 0;
+    if ((!count_s.empty() && !parse(count_s, count)) || 
+      (!interval_s.empty() && !parse(interval_s, interval_ms)))
+    {
+        out.append("ERROR");
+        return;
+    }
+    count = std::min(count, max_series);
+    TRACE_STAGE(TraceStage::PARSED);
+    auto tape = order_book.tape(productID);
+    auto interval = tape == nullptr ? 0 : interval_s.empty() ? 0 : 
+      tape->interval(interval_ms * 1'000'000);
+    TradeTape::Bar bars[max_series];
+    if (tape == nullptr || interval == tape->intervals_ns().size())
+    {
+        TRACE_STAGE(TraceStage::APPLIED);
+        out.append("ERROR");
+        return;
+    }
+    count = tape->last_bars(interval, bars, count);
+    TRACE_STAGE(TraceStage::APPLIED);
+
+    out.append("OK: ");
+    for (size_t i = 0; i < count; i++)
+    {
+        const auto& bar = bars[i];
+        if (i != 0)
+        {
+            out.append('|');
+        }
+        out.append(bar.start_ns / 1'000'000);
+        out.append(' ');
+        out.append(uint64_t{bar.open});
+        out.append(' ');
+        out.append(uint64_t{bar.high});
+        out.append(' ');
+        out.append(uint64_t{bar.low});
+        out.append(' ');
+        out.append(uint64_t{bar.close});
+        out.append(' ');
+        out.append(bar.volume);
+        out.append(' ');
+        out.append(bar.vwap(), 4);
+    }
+}
+void OrderBookParser::trades(std::string& parameters, OutputBuffer& out)
+{
+    // TRADES ProductId [Count]
+    //  E.g.: TRADES 1. By default the last 10 trades, 16 at most.
+    // Reply: OK: TimeMs Price Quantity|..., the newest first.
+
+    std::stringstream ss{parameters};
+    std::string productID, count_s;
+    std::getline(ss, productID, ' ');
+    std::getline(ss, count_s);
+
+    size_t count = default_series;
+    if (!count_s.empty() && !parse(count_s, count))
+    {
+        out.append("ERROR");
+        return;
+    }
+    count = std::min(count, max_series);
+    TRACE_STAGE(TraceStage::PARSED);
+    auto tape = order_book.tape(productID);
+    TradeTape::Trade trades[max_series];
+    if (tape == nullptr)
+    {
+        TRACE_STAGE(TraceStage::APPLIED);
+        out.append("ERROR");
+        return;
+    }
+    count = tape->last_trades(trades, count);
+    TRACE_STAGE(TraceStage::APPLIED);
+
+    out.append("OK: ");
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i != 0)
+        {
+            out.append('|');
+        }
+        out.append(trades[i].time_ns / 1'000'000);
+        out.append(' ');
+        out.append(uint64_t{trades[i].price});
+        out.append(' ');
+        out.append(uint64_t{trades[i].quantity});
+    }
+}
+std::string OrderBookParser::handoff_out(std::string& parameters)
+{
+    // HANDOFF_OUT ProductId
+    //  E.g.: HANDOFF_OUT 1
+    // Removes the product from this book. The reply carries how many orders
+    //  and the orders in the CREATE parameters format, separated by ';': what
+    //  follows "OK: " is HANDOFF_IN's parameters as is. A good-till-time 
+    //  order carries the lifetime it has left, rounded up.
+    //  E.g.: OK: 2 1 1 BUY 1 1;3 1 SELL 2 1 5000
+
+    std::stringstream ss{parameters};
+    std::string productID;
+    std::getline(ss, productID);
+
+    TRACE_STAGE(TraceStage::PARSED);
+    std::vector<uint64_t> expires_ns;
+    auto extracted = order_book.extract_product(productID, expires_ns);
+    TRACE_STAGE(TraceStage::APPLIED);
+
+    std::ostringstream oss;
+    oss << "OK: " << extracted.size();
+    const auto now = OrderBook::now_ns();
+    for (size_t i = 0; i < extracted.size(); i++)
+    {
+        oss << (i == 0 ? " " : ";") << extracted[i].to_string();
+        if (expires_ns[i] != 0)
+        {
+            uint64_t lifetime_ms = expires_ns[i] > now ? 
+              (expires_ns[i] - now + 999'999) / 1'000'000 : 0;
+            oss << " " << std::min(lifetime_ms, max_lifetime_ms);
+        }
+    }
+
+    return oss.str();
+}
+std::string OrderBookParser::handoff_in(std::string& parameters)
+{
+    // HANDOFF_IN Count Order;Order;...
+    //  E.g.: HANDOFF_IN 2 1 1 BUY 1 1;3 1 SELL 2 1 5000, from HANDOFF_OUT's 
+    //  reply. ERROR if there aren't Count orders (e.g. a cut reply).
+
+    std::vector<Order> product_orders;
+    std::vector<uint64_t> expires_ns;
+    std::stringstream ss{parameters};
+    std::string count_s, order_s;
+    std::getline(ss, count_s, ' ');
+    size_t count;
+    if (!parse(count_s, count))
+    {
+        return "ERROR";
+    }
+    while (std::getline(ss, order_s, ';'))
+    {
+        std::stringstream order_ss{order_s};
+        std::string verb_s, price_s, quantity_s, lifetime_s;
+        Order order;
+        std::getline(order_ss, order.orderID, ' ');
+        std::getline(order_ss, order.productID, ' ');
+        std::getline(order_ss, verb_s, ' ');
+        std::getline(order_ss, price_s, ' ');
+        std::getline(order_ss, quantity_s, ' ');
+        std::getline(order_ss, lifetime_s);
+        order.verb = verb_s == "BUY" ? Order::Verb::BUY : Order::Verb::SELL;
+        uint64_t order_expires_ns;
+        if (!parse(price_s, order.price) || 
+          !parse(quantity_s, order.quantity) || 
+          !parse_lifetime(lifetime_s, order_expires_ns))
+        {
+            return "ERROR";
+        }
+        product_orders.push_back(std::move(order));
+        expires_ns.push_back(order_expires_ns);
+    }
+
+    TRACE_STAGE(TraceStage::PARSED);
+    auto result = product_orders.size() == count && 
+      order_book.insert_product(product_orders, expires_ns);
+    TRACE_STAGE(TraceStage::APPLIED);
+    return result ? "OK" : "ERROR";
+}
@@ -0,0 +1,272 @@
+// Hardware performance counters through perf_event_open(), for this thread in
+//  user space only: cycles, instructions, L1D/LLC read misses, branch misses,
+//  dTLB read misses. PerfCounters reads them all at once (one read() on the 
+//  group); PhaseProfile accumulates the deltas per operation type and phase 
+//  (e.g. parse, apply, respond) and prints per-operation averages.
+// Needs perf_event_paranoid <= 2 (or CAP_PERFMON). Events the CPU or the VM 
+//  doesn't expose are skipped and reported as n/a.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <iomanip>
+// POSIX/Linux
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+
+class PerfCounters
+{
+  public:
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,
+        LLC_MISSES,
+        BRANCH_MISSES,
+        DTLB_MISSES,
+        EVENT_COUNT
+    };
+
+    struct Sample
+    {
+        uint64_t values[EVENT_COUNT];
+    };
+
+    static const char* event_name(Event event)
+    {
+        static const char* names[] = {"cycles", "instr", "L1D-miss", 
+          "LLC-miss", "br-miss", "dTLB-miss"};
+        return names[event];
+    }
+
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // False if not even the group leader (cycles) could be opened.
+    bool available() const
+    {
+        return m_fds[CYCLES] >= 0;
+    }
+    bool has(Event event) const
+    {
+        return m_fds[event] >= 0;
+    }
+    // Why the leader couldn't be opened.
+    const std::string& error() const
+    {
+        return m_error;
+    }
+
+    // Current totals since the group was enabled; missing events read 0.
+    //  Scaled if the kernel had to multiplex the group.
+    void read(Sample& sample) const;
+
+  private:
+    int m_fds[EVENT_COUNT];
+    int m_slots[EVENT_COUNT]; // Position in the group read, -1 if missing.
+    int m_opened{0};
+    std::string m_error;
+};
+
+PerfCounters::PerfCounters()
+{
+    auto cache_event = [](uint64_t cache, uint64_t op, uint64_t result) {
+        return cache | (op << 8) | (result << 16);
+    };
+    const struct
+    {
+        uint32_t type;
+        uint64_t config;
+    } events[EVENT_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_L1D, 
+          PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL, 
+          PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, 
+          PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    };
+
+    for (int event = 0; event < EVENT_COUNT; event++)
+    {
+        m_fds[event] = -1;
+        m_slots[event] = -1;
+
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[event].type;
+        attr.config = events[event].config;
+        attr.exclude_kernel = 1; // The read() syscalls themselves don't count.
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | 
+          PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // The leader starts disabled, then enables the whole group at once.
+        attr.disabled = event == CYCLES ? 1 : 0;
+
+        auto group_fd = event == CYCLES ? -1 : m_fds[CYCLES];
+        if (event != CYCLES && group_fd < 0)
+        {
+            continue;
+        }
+        m_fds[event] = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+        if (m_fds[event] < 0)
+        {
+            if (event == CYCLES)
+            {
+                m_error = std::strerror(errno);
+            }
+            continue;
+        }
+        m_slots[event] = m_opened++;
+    }
+
+    if (available())
+    {
+        ioctl(m_fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (auto fd : m_fds)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+}
+
+void PerfCounters::read(Sample& sample) const
+{
+    std::memset(&sample, 0, sizeof(sample));
+    if (!available())
+    {
+        return;
+    }
+
+    // PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, values[nr].
+    uint64_t buffer[3 + EVENT_COUNT];
+    if (::read(m_fds[CYCLES], buffer, sizeof(buffer)) < 0)
+    {
+        return;
+    }
+
+    const uint64_t enabled = buffer[1];
+    const uint64_t running = buffer[2];
+    for (int event = 0; event < EVENT_COUNT; event++)
+    {
+        if (m_slots[event] < 0)
+        {
+            continue;
+        }
+        uint64_t value = buffer[3 + m_slots[event]];
+        if (running != 0 && running < enabled)
+        {
+            value = static_cast<uint64_t>(static_cast<double>(value) * 
+              enabled / running);
+        }
+        sample.values[event] = value;
+    }
+}
+
+// Counter deltas per (operation type, phase). The caller reads the counters 
+//  at every phase boundary and hands consecutive samples to add().
+class PhaseProfile
+{
+  public:
+    PhaseProfile(std::vector<std::string> operations, 
+      std::vector<std::string> phases)
+    : m_operations{std::move(operations)}, m_phases{std::move(phases)}, 
+      m_totals(m_operations.size() * m_phases.size()), 
+      m_counts(m_operations.size(), 0)
+    {}
+
+    void add(size_t operation, size_t phase, 
+      const PerfCounters::Sample& before, const PerfCounters::Sample& after)
+    {
+        auto& total = m_totals[operation * m_phases.size() + phase];
+        for (int event = 0; event < PerfCounters::EVENT_COUNT; event++)
+        {
+            total.values[event] += after.values[event] - before.values[event];
+        }
+    }
+    // Once per operation, after its phases.
+    void count(size_t operation)
+    {
+        m_counts[operation] += 1;
+    }
+
+    void report(std::ostream& out, const PerfCounters& counters) const;
+
+  private:
+    std::vector<std::string> m_operations;
+    std::vector<std::string> m_phases;
+    std::vector<PerfCounters::Sample> m_totals;
+    std::vector<uint64_t> m_counts;
+};
+
+void PhaseProfile::report(std::ostream& out, const PerfCounters& counters) const
+{
+    if (!counters.available())
+    {
+        out << "Performance counters unavailable: " << counters.error() << "\n";
+        return;
+    }
+
+    out << "  " << std::left << std::setw(16) << "operation" << std::setw(9) 
+      << "phase" << std::right;
+    for (int event = 0; event < PerfCounters::EVENT_COUNT; event++)
+    {
+        out << std::setw(11) << PerfCounters::event_name(
+          static_cast<PerfCounters::Event>(event));
+    }
+    out << std::setw(7) << "IPC" << "   (per operation)\n";
+
+    for (size_t operation = 0; operation < m_operations.size(); operation++)
+    {
+        const auto count = m_counts[operation];
+        if (count == 0)
+        {
+            continue;
+        }
+        for (size_t phase = 0; phase < m_phases.size(); phase++)
+        {
+            const auto& total = m_totals[operation * m_phases.size() + phase];
+            out << "  " << std::left << std::setw(16) 
+              << (phase == 0 ? m_operations[operation] : "") << std::setw(9) 
+              << m_phases[phase] << std::right << std::fixed 
+              << std::setprecision(2);
+            for (int event = 0; event < PerfCounters::EVENT_COUNT; event++)
+            {
+                if (counters.has(static_cast<PerfCounters::Event>(event)))
+                {
+                    out << std::setw(11) 
+                      << static_cast<double>(total.values[event]) / count;
+                }
+                else
+                {
+                    out << std::setw(11) << "n/a";
+                }
+            }
+            const auto cycles = total.values[PerfCounters::CYCLES];
+            out << std::setw(7) << (cycles ? static_cast<double>(
+              total.values[PerfCounters::INSTRUCTIONS]) / cycles : 0.0) << "\n";
+        }
+    }
+}
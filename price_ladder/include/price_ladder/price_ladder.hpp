@@ -0,0 +1,761 @@
+// One side of one product: price => total quantity, on a flat array of ticks.
+// A level is m_quantities[price - m_base]; an occupancy bitmap on top of it,
+//  3 levels of 64-bit words, says which ticks are non-empty:
+//  - level 0: 1 bit per tick;
+//  - level 1: 1 bit per level-0 word (i.e. per 64 ticks);
+//  - level 2: 1 bit per level-1 word (i.e. per 4096 ticks), a single word.
+// The next non-empty tick above/below any tick is then at most 3 words away,
+//  each one a tzcnt/lzcnt: best-price recovery after the best level empties
+//  is constant-time, however sparse the book is.
+// The window [m_base, m_base + size) grows by doubling up to max_ticks and
+//  re-centers on the live levels when a price falls outside it, the bitmap
+//  shifted a word at a time. Prices that can't fit (a spread wider than
+//  max_ticks, or too close to it to leave room, see fit()) go to a small 
+//  std::map.
+// Levels being contiguous also makes a depth sweep (cost of taking N units)
+//  a prefix sum over an array, see sweep().
+
+#pragma once
+
+#include <bit> // For countl_zero/countr_zero (lzcnt/tzcnt).
+#include <algorithm>
+#include <immintrin.h>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+
+class PriceLadder
+{
+  public:
+    static constexpr size_t max_ticks{64 * 64 * 64};
+
+    PriceLadder() = default;
+
+    // Bounded-memory mode: the window gets 'ticks' (a power of 2, at most 
+    //  max_ticks) now and never grows nor uses the std::map. It still moves 
+    //  with the prices, in place. add() of a price it can't cover throws: ask
+    //  accepts() first.
+    void reserve_fixed(size_t ticks);
+    // Whether prices in [low, high] can be added. Always true unless fixed.
+    bool accepts(uint32_t low, uint32_t high) const;
+
+    // Adds quantity at price. Throws std::out_of_range on overflow.
+    void add(uint32_t price, uint32_t quantity);
+    // Removes quantity at price, the level goes away at 0. Throws
+    //  std::out_of_range if the level doesn't exist.
+    void remove(uint32_t price, uint32_t quantity);
+    void clear();
+
+    uint32_t quantity(uint32_t price) const;
+    bool empty() const
+    {
+        return m_levels == 0;
+    }
+    // Number of non-empty levels.
+    size_t levels() const
+    {
+        return m_levels;
+    }
+
+    // Best levels: highest for bids, lowest for asks. False if empty.
+    bool highest(uint32_t& price, uint32_t& quantity) const;
+    bool lowest(uint32_t& price, uint32_t& quantity) const;
+    // Up to max_levels, best first (descending for bids, ascending for asks).
+    //  Returns how many were written.
+    size_t best_levels(bool descending, uint32_t* prices, uint32_t* quantities,
+      size_t max_levels) const;
+
+    // What taking 'quantity' would do right now, walking away from the best
+    //  level (descending for bids, ascending for asks).
+    struct Sweep
+    {
+        uint64_t filled{0}; // Less than asked if the side runs out.
+        uint64_t cost{0}; // Sum of price * taken: exact, 32 x 32 bits at most.
+        uint32_t last_price{0}; // The worst price touched.
+        uint32_t levels{0}; // Levels touched, the last one maybe in part.
+    };
+    Sweep sweep(bool descending, uint32_t quantity) const;
+
+  private:
+    uint32_t m_base{0};
+    std::vector<uint32_t> m_quantities; // One per tick of the window.
+    std::vector<uint64_t> m_bits0;
+    std::vector<uint64_t> m_bits1;
+    uint64_t m_bits2{0};
+    size_t m_levels{0}; // Window + outside.
+    bool m_fixed{false};
+    std::map<uint32_t, uint32_t> m_outside;
+
+    static constexpr ptrdiff_t none{-1};
+
+    bool in_window(uint32_t price) const
+    {
+        return price >= m_base && price - m_base < m_quantities.size();
+    }
+
+    void set_bit(size_t tick)
+    {
+        m_bits0[tick >> 6] |= uint64_t{1} << (tick & 63);
+        m_bits1[tick >> 12] |= uint64_t{1} << ((tick >> 6) & 63);
+        m_bits2 |= uint64_t{1} << ((tick >> 12) & 63);
+    }
+    void clear_bit(size_t tick)
+    {
+        auto& word0 = m_bits0[tick >> 6];
+        word0 &= ~(uint64_t{1} << (tick & 63));
+        if (word0 != 0)
+        {
+            return;
+        }
+        auto& word1 = m_bits1[tick >> 12];
+        word1 &= ~(uint64_t{1} << ((tick >> 6) & 63));
+        if (word1 != 0)
+        {
+            return;
+        }
+        m_bits2 &= ~(uint64_t{1} << ((tick >> 12) & 63));
+    }
+
+    // Highest non-empty tick <= tick, none if there isn't one.
+    ptrdiff_t at_or_below(size_t tick) const
+    {
+        // Same word: keep bits [0, tick & 63].
+        size_t index0 = tick >> 6;
+        uint64_t word = m_bits0[index0] & (~uint64_t{0} >> (63 - (tick & 63)));
+        if (word != 0)
+        {
+            return index0 * 64 + 63 - std::countl_zero(word);
+        }
+        // Lower words of the same level-1 word: keep bits [0, index0 & 63).
+        size_t index1 = index0 >> 6;
+        word = m_bits1[index1] & ((uint64_t{1} << (index0 & 63)) - 1);
+        if (word == 0)
+        {
+            word = m_bits2 & ((uint64_t{1} << (index1 & 63)) - 1);
+            if (word == 0)
+            {
+                return none;
+            }
+            index1 = 63 - std::countl_zero(word);
+            word = m_bits1[index1];
+        }
+        index0 = index1 * 64 + 63 - std::countl_zero(word);
+        return index0 * 64 + 63 - std::countl_zero(m_bits0[index0]);
+    }
+    // Lowest non-empty tick >= tick, none if there isn't one.
+    ptrdiff_t at_or_above(size_t tick) const
+    {
+        // Same word: keep bits [tick & 63, 63].
+        size_t index0 = tick >> 6;
+        uint64_t word = m_bits0[index0] & (~uint64_t{0} << (tick & 63));
+        if (word != 0)
+        {
+            return index0 * 64 + std::countr_zero(word);
+        }
+        // Upper words of the same level-1 word: keep bits (index0 & 63, 63].
+        size_t index1 = index0 >> 6;
+        word = (index0 & 63) == 63 ? 0 :
+          m_bits1[index1] & (~uint64_t{0} << ((index0 & 63) + 1));
+        if (word == 0)
+        {
+            word = (index1 & 63) == 63 ? 0 :
+              m_bits2 & (~uint64_t{0} << ((index1 & 63) + 1));
+            if (word == 0)
+            {
+                return none;
+            }
+            index1 = std::countr_zero(word);
+            word = m_bits1[index1];
+        }
+        index0 = index1 * 64 + std::countr_zero(word);
+        return index0 * 64 + std::countr_zero(m_bits0[index0]);
+    }
+
+    // Next non-empty tick after 'tick', moving away from the touch.
+    ptrdiff_t next(bool descending, ptrdiff_t tick) const
+    {
+        if (descending)
+        {
+            return tick == 0 ? none : at_or_below(tick - 1);
+        }
+        return size_t(tick) + 1 == m_quantities.size() ? none : 
+          at_or_above(tick + 1);
+    }
+
+    static void take(uint32_t price, uint32_t quantity, uint64_t wanted, 
+      Sweep& sweep)
+    {
+        auto taken = std::min<uint64_t>(quantity, wanted - sweep.filled);
+        sweep.filled += taken;
+        sweep.cost += taken * price;
+        sweep.last_price = price;
+        sweep.levels += 1;
+    }
+    static bool has_avx2()
+    {
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+    void sweep_window(bool descending, uint64_t wanted, Sweep& sweep) const;
+    __attribute__((target("avx2")))
+    void sweep_window_avx2(bool descending, uint64_t wanted, Sweep& sweep) 
+      const;
+
+    bool fit(uint32_t price);
+    void rebuild(uint32_t base, size_t ticks);
+    void shift_bits(ptrdiff_t offset);
+};
+
+void PriceLadder::add(uint32_t price, uint32_t quantity)
+{
+    // Orders of quantity 0 don't make a level.
+    if (quantity == 0)
+    {
+        return;
+    }
+    if (in_window(price) || fit(price))
+    {
+        auto tick = price - m_base;
+        auto& level = m_quantities[tick];
+        if (std::numeric_limits<uint32_t>::max() - level < quantity)
+        {
+            throw std::out_of_range{"Quantity overflow."};
+        }
+        if (level == 0)
+        {
+            set_bit(tick);
+            m_levels += 1;
+        }
+        level += quantity;
+        return;
+    }
+
+    if (m_fixed)
+    {
+        throw std::out_of_range{"Price outside the fixed window."};
+    }
+    auto [it, inserted] = m_outside.try_emplace(price, 0);
+    if (std::numeric_limits<uint32_t>::max() - it->second < quantity)
+    {
+        throw std::out_of_range{"Quantity overflow."};
+    }
+    it->second += quantity;
+    m_levels += inserted;
+}
+
+void PriceLadder::remove(uint32_t price, uint32_t quantity)
+{
+    if (quantity == 0)
+    {
+        return;
+    }
+    if (in_window(price))
+    {
+        auto tick = price - m_base;
+        auto& level = m_quantities[tick];
+        if (level == 0)
+        {
+            throw std::out_of_range{"Price doesn't exist."};
+        }
+        level -= quantity;
+        if (level == 0) // It won't never be <0.
+        {
+            clear_bit(tick);
+            m_levels -= 1;
+        }
+        return;
+    }
+
+    auto it = m_outside.find(price);
+    if (it == m_outside.end())
+    {
+        throw std::out_of_range{"Price doesn't exist."};
+    }
+    it->second -= quantity;
+    if (it->second == 0)
+    {
+        m_outside.erase(it);
+        m_levels -= 1;
+    }
+}
+
+void PriceLadder::clear()
+{
+    if (m_fixed)
+    {
+        // Keep the memory.
+        std::fill(m_quantities.begin(), m_quantities.end(), 0);
+        std::fill(m_bits0.begin(), m_bits0.end(), 0);
+        std::fill(m_bits1.begin(), m_bits1.end(), 0);
+        m_bits2 = 0;
+        m_levels = 0;
+        return;
+    }
+    m_quantities.clear();
+    m_bits0.clear();
+    m_bits1.clear();
+    m_bits2 = 0;
+    m_base = 0;
+    m_levels = 0;
+    m_outside.clear();
+}
+
+uint32_t PriceLadder::quantity(uint32_t price) const
+{
+    if (in_window(price))
+    {
+        return m_quantities[price - m_base];
+    }
+    auto it = m_outside.find(price);
+    return it == m_outside.end() ? 0 : it->second;
+}
+
+bool PriceLadder::highest(uint32_t& price, uint32_t& quantity) const
+{
+    if (m_levels == 0)
+    {
+        return false;
+    }
+
+    ptrdiff_t tick = m_quantities.empty() ? none :
+      at_or_below(m_quantities.size() - 1);
+    // Outside levels above the window beat it.
+    if (!m_outside.empty() && (tick == none ||
+      m_outside.rbegin()->first > m_base + tick))
+    {
+        price = m_outside.rbegin()->first;
+        quantity = m_outside.rbegin()->second;
+        return true;
+    }
+    price = m_base + tick;
+    quantity = m_quantities[tick];
+    return true;
+}
+bool PriceLadder::lowest(uint32_t& price, uint32_t& quantity) const
+{
+    if (m_levels == 0)
+    {
+        return false;
+    }
+
+    ptrdiff_t tick = m_quantities.empty() ? none : at_or_above(0);
+    // Outside levels below the window beat it.
+    if (!m_outside.empty() && (tick == none ||
+      m_outside.begin()->first < m_base + tick))
+    {
+        price = m_outside.begin()->first;
+        quantity = m_outside.begin()->second;
+        return true;
+    }
+    price = m_base + tick;
+    quantity = m_quantities[tick];
+    return true;
+}
+
+size_t PriceLadder::best_levels(bool descending, uint32_t* prices,
+  uint32_t* quantities, size_t max_levels) const
+{
+    size_t count = 0;
+    auto emit = [&](uint32_t price, uint32_t quantity)
+    {
+        prices[count] = price;
+        quantities[count] = quantity;
+        count += 1;
+    };
+
+    // Outside levels are either all below or all above the window for a given
+    //  price, so: outside (better side), window, outside (worse side).
+    if (descending)
+    {
+        auto it = m_outside.rbegin();
+        for (; it != m_outside.rend() && count < max_levels &&
+          it->first >= m_base + m_quantities.size(); it++)
+        {
+            emit(it->first, it->second);
+        }
+        ptrdiff_t tick = m_quantities.empty() ? none :
+          at_or_below(m_quantities.size() - 1);
+        for (; tick != none && count < max_levels;
+          tick = tick == 0 ? none : at_or_below(tick - 1))
+        {
+            emit(m_base + tick, m_quantities[tick]);
+        }
+        for (; it != m_outside.rend() && count < max_levels; it++)
+        {
+            emit(it->first, it->second);
+        }
+    }
+    else
+    {
+        auto it = m_outside.begin();
+        for (; it != m_outside.end() && count < max_levels &&
+          it->first < m_base; it++)
+        {
+            emit(it->first, it->second);
+        }
+        ptrdiff_t tick = m_quantities.empty() ? none : at_or_above(0);
+        for (; tick != none && count < max_levels;
+          tick = size_t(tick) + 1 == m_quantities.size() ? none :
+            at_or_above(tick + 1))
+        {
+            emit(m_base + tick, m_quantities[tick]);
+        }
+        for (; it != m_outside.end() && count < max_levels; it++)
+        {
+            emit(it->first, it->second);
+        }
+    }
+
+    return count;
+}
+
+PriceLadder::Sweep PriceLadder::sweep(bool descending, uint32_t quantity) 
+  const
+{
+    Sweep sweep;
+    const uint64_t top = uint64_t{m_base} + m_quantities.size();
+
+    // Same order as best_levels(): outside (better side), window, outside 
+    //  (worse side).
+    if (descending)
+    {
+        auto it = m_outside.rbegin();
+        for (; it != m_outside.rend() && sweep.filled < quantity && 
+          it->first >= top; it++)
+        {
+            take(it->first, it->second, quantity, sweep);
+        }
+        if (!m_quantities.empty() && sweep.filled < quantity)
+        {
+            has_avx2() ? sweep_window_avx2(true, quantity, sweep) : 
+              sweep_window(true, quantity, sweep);
+        }
+        for (; it != m_outside.rend() && sweep.filled < quantity; it++)
+        {
+            take(it->first, it->second, quantity, sweep);
+        }
+    }
+    else
+    {
+        auto it = m_outside.begin();
+        for (; it != m_outside.end() && sweep.filled < quantity && 
+          it->first < m_base; it++)
+        {
+            take(it->first, it->second, quantity, sweep);
+        }
+        if (!m_quantities.empty() && sweep.filled < quantity)
+        {
+            has_avx2() ? sweep_window_avx2(false, quantity, sweep) : 
+              sweep_window(false, quantity, sweep);
+        }
+        for (; it != m_outside.end() && sweep.filled < quantity; it++)
+        {
+            take(it->first, it->second, quantity, sweep);
+        }
+    }
+
+    return sweep;
+}
+
+// One level per step, the bitmap skips the empty ticks.
+void PriceLadder::sweep_window(bool descending, uint64_t wanted, Sweep& sweep) 
+  const
+{
+    ptrdiff_t tick = descending ? at_or_below(m_quantities.size() - 1) : 
+      at_or_above(0);
+    while (tick != none && sweep.filled < wanted)
+    {
+        take(m_base + tick, m_quantities[tick], wanted, sweep);
+        tick = next(descending, tick);
+    }
+}
+
+// 4 ticks per step, from the next non-empty one: a dense ladder is a 
+//  contiguous array, so a block is one load and an in-register prefix sum 
+//  tells whether the block is taken whole or where the sweep stops in it.
+//  Sparse ladders degrade to one level per step, jumping via the bitmap.
+// 64-bit lanes: the running total of 4 uint32 quantities can't overflow.
+__attribute__((target("avx2")))
+void PriceLadder::sweep_window_avx2(bool descending, uint64_t wanted, 
+  Sweep& sweep) const
+{
+    const ptrdiff_t size = m_quantities.size();
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i distance = _mm256_setr_epi64x(0, 1, 2, 3);
+
+    ptrdiff_t tick = descending ? at_or_below(size - 1) : at_or_above(0);
+    while (tick != none && sweep.filled < wanted)
+    {
+        // Lane i is i ticks away from 'tick'.
+        ptrdiff_t low = descending ? tick - 3 : tick;
+        if (low < 0 || low + 4 > size)
+        {
+            // Edge of the window.
+            take(m_base + tick, m_quantities[tick], wanted, sweep);
+            tick = next(descending, tick);
+            continue;
+        }
+        __m256i quantities = _mm256_cvtepu32_epi64(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(m_quantities.data() + low)));
+        if (descending)
+        {
+            quantities = _mm256_permute4x64_epi64(quantities, 
+              _MM_SHUFFLE(0, 1, 2, 3));
+        }
+
+        // Inclusive prefix sum: add the lanes shifted by 1, then by 2.
+        __m256i sums = _mm256_add_epi64(quantities, _mm256_blend_epi32(
+          _mm256_permute4x64_epi64(quantities, _MM_SHUFFLE(2, 1, 0, 0)), 
+          zero, 0x03));
+        sums = _mm256_add_epi64(sums, _mm256_blend_epi32(
+          _mm256_permute4x64_epi64(sums, _MM_SHUFFLE(1, 0, 0, 0)), 
+          zero, 0x0F));
+
+        // First lane whose running total covers what's still missing.
+        const uint64_t missing = wanted - sweep.filled;
+        int reached = _mm256_movemask_pd(_mm256_castsi256_pd(
+          _mm256_cmpgt_epi64(sums, _mm256_set1_epi64x(missing - 1))));
+        if (reached != 0)
+        {
+            // The sweep ends in this block: at most 4 levels left.
+            ptrdiff_t end = std::countr_zero(unsigned(reached));
+            for (ptrdiff_t i = 0; i <= end; i++)
+            {
+                auto t = descending ? tick - i : tick + i;
+                if (m_quantities[t] != 0)
+                {
+                    take(m_base + t, m_quantities[t], wanted, sweep);
+                }
+            }
+            return;
+        }
+
+        // The whole block is taken. Cost: price(tick) * total, +/- the sum of
+        //  quantity * distance.
+        const uint64_t total = _mm256_extract_epi64(sums, 3);
+        __m256i weighted = _mm256_mul_epu32(quantities, distance);
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(weighted), 
+          _mm256_extracti128_si256(weighted, 1));
+        const uint64_t offsets = _mm_cvtsi128_si64(half) + 
+          _mm_extract_epi64(half, 1);
+        const uint64_t price = m_base + tick;
+        sweep.filled += total;
+        sweep.cost += descending ? price * total - offsets : 
+          price * total + offsets;
+
+        unsigned empty = _mm256_movemask_pd(_mm256_castsi256_pd(
+          _mm256_cmpeq_epi64(quantities, zero)));
+        unsigned full = ~empty & 0xF;
+        sweep.levels += std::popcount(full);
+        auto last = 31 - std::countl_zero(full);
+        sweep.last_price = descending ? price - last : price + last;
+
+        // Dense: the next block starts right after this one, no bitmap search.
+        ptrdiff_t after = descending ? tick - 4 : tick + 4;
+        tick = after >= 0 && after < size && m_quantities[after] != 0 ? after :
+          next(descending, descending ? tick - 3 : tick + 3);
+    }
+}
+
+void PriceLadder::reserve_fixed(size_t ticks)
+{
+    clear();
+    size_t size = 64;
+    while (size < ticks && size < max_ticks)
+    {
+        size *= 2;
+    }
+    m_fixed = false;
+    rebuild(0, size);
+    m_fixed = true;
+}
+
+bool PriceLadder::accepts(uint32_t low, uint32_t high) const
+{
+    if (!m_fixed)
+    {
+        return true;
+    }
+    uint64_t span_low = low;
+    uint64_t span_high = high;
+    if (m_levels != 0)
+    {
+        span_low = std::min<uint64_t>(span_low, m_base + at_or_above(0));
+        span_high = std::max<uint64_t>(span_high, m_base + 
+          at_or_below(m_quantities.size() - 1));
+    }
+    return span_high - span_low + 1 <= m_quantities.size();
+}
+
+// Tries to move/grow the window so that it covers price and every level
+//  already in it. False if that would take more than max_ticks.
+bool PriceLadder::fit(uint32_t price)
+{
+    uint64_t low = price;
+    uint64_t high = price;
+    ptrdiff_t tick = m_quantities.empty() ? none : at_or_above(0);
+    if (tick != none)
+    {
+        low = std::min<uint64_t>(low, m_base + tick);
+        high = std::max<uint64_t>(high, m_base +
+          at_or_below(m_quantities.size() - 1));
+    }
+
+    uint64_t span = high - low + 1;
+    if (span > max_ticks)
+    {
+        return false;
+    }
+    // Hysteresis: a full-size window only slides if that leaves a quarter of
+    //  it free, or prices drifting past its edge would slide it on every add.
+    //  Until then they go to the std::map, and the next slide moves them in.
+    if (!m_fixed && m_quantities.size() == max_ticks && 
+      span > max_ticks - max_ticks / 4)
+    {
+        return false;
+    }
+
+    if (m_fixed && span > m_quantities.size())
+    {
+        return false;
+    }
+
+    // Twice the span, so that the next prices around the touch land inside.
+    //  A fixed window only moves.
+    size_t ticks = std::max<size_t>(m_quantities.size(), 64);
+    while (!m_fixed && ticks < 2 * span && ticks < max_ticks)
+    {
+        ticks *= 2;
+    }
+    uint64_t base = low - std::min<uint64_t>(low, (ticks - span) / 2);
+    uint64_t top = uint64_t{std::numeric_limits<uint32_t>::max()} + 1;
+    if (base + ticks > top)
+    {
+        base = top - ticks;
+    }
+    rebuild(base, ticks);
+    return true;
+}
+
+void PriceLadder::shift_bits(ptrdiff_t offset)
+{
+    // Bit 'tick' moves to 'tick + offset'. Words are written away from where
+    //  the bits come from (down when they move up, up when they move down),
+    //  so each one is read before it's overwritten.
+    const auto words = ptrdiff_t(m_bits0.size());
+    auto bits = [&](ptrdiff_t first)
+      {
+          // The 64 bits from tick 'first' on, 0 past either end.
+          auto index = first >> 6;
+          auto shift = unsigned(first & 63);
+          uint64_t low = index >= 0 && index < words ? m_bits0[index] : 0;
+          if (shift == 0)
+          {
+              return low;
+          }
+          uint64_t high = index + 1 >= 0 && index + 1 < words ? 
+            m_bits0[index + 1] : 0;
+          return (low >> shift) | (high << (64 - shift));
+      };
+    if (offset > 0)
+    {
+        for (auto index = words - 1; index >= 0; index--)
+        {
+            m_bits0[index] = bits(index * 64 - offset);
+        }
+    }
+    else
+    {
+        for (ptrdiff_t index = 0; index < words; index++)
+        {
+            m_bits0[index] = bits(index * 64 - offset);
+        }
+    }
+
+    // Levels 1 and 2 from level 0: a bit per word.
+    std::fill(m_bits1.begin(), m_bits1.end(), 0);
+    m_bits2 = 0;
+    for (ptrdiff_t index = 0; index < words; index++)
+    {
+        if (m_bits0[index] != 0)
+        {
+            m_bits1[index >> 6] |= uint64_t{1} << (index & 63);
+            m_bits2 |= uint64_t{1} << ((index >> 6) & 63);
+        }
+    }
+}
+
+void PriceLadder::rebuild(uint32_t base, size_t ticks)
+{
+    if (ticks == m_quantities.size())
+    {
+        // Same size: the levels slide in place, no allocation. They all fit 
+        //  the new window, so only empty ticks fall off the edge.
+        auto shift = std::min<size_t>(base > m_base ? base - m_base : 
+          m_base - base, ticks);
+        if (base > m_base)
+        {
+            std::copy(m_quantities.begin() + shift, m_quantities.end(), 
+              m_quantities.begin());
+            std::fill(m_quantities.end() - shift, m_quantities.end(), 0);
+        }
+        else
+        {
+            std::copy_backward(m_quantities.begin(), m_quantities.end() - shift,
+              m_quantities.end());
+            std::fill(m_quantities.begin(), m_quantities.begin() + shift, 0);
+        }
+    }
+    else
+    {
+        std::vector<uint32_t> quantities(ticks, 0);
+        for (size_t tick = 0; tick < m_quantities.size(); tick++)
+        {
+            if (m_quantities[tick] != 0)
+            {
+                quantities[m_base + tick - base] = m_quantities[tick];
+            }
+        }
+        m_quantities.swap(quantities);
+    }
+
+    if (ticks == m_bits0.size() * 64)
+    {
+        // The bitmap slides in place too, a word at a time: no scan of the
+        //  ticks.
+        shift_bits(ptrdiff_t(m_base) - ptrdiff_t(base));
+    }
+    else
+    {
+        m_bits0.assign((ticks + 63) / 64, 0);
+        m_bits1.assign((ticks + 4095) / 4096, 0);
+        m_bits2 = 0;
+        for (size_t tick = 0; tick < ticks; tick++)
+        {
+            if (m_quantities[tick] != 0)
+            {
+                set_bit(tick);
+            }
+        }
+    }
+    m_base = base;
+
+    // Outside levels the new window covers move in.
+    for (auto it = m_outside.begin(); it != m_outside.end();)
+    {
+        if (in_window(it->first))
+        {
+            m_quantities[it->first - m_base] = it->second;
+            set_bit(it->first - m_base);
+            it = m_outside.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
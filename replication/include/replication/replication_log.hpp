@@ -0,0 +1,193 @@
+// Leader side of the hot-standby replication: the book's accepted mutations,
+//  sequenced, as command lines a follower replays with its own
+//  OrderBookParser ("CREATE 1 A BUY 10 5", "DELETE 1", ...). Effects, not
+//  requests: an expiry or a session cancel is the DELETEs it did, so a
+//  follower ends up with exactly the leader's book whatever its clock.
+// Records go to every attached follower's pending buffer, and the last
+//  'retained' ones stay for a reconnecting follower to catch up from its last
+//  sequence instead of taking a whole snapshot.
+// Wire format (one line each):
+//  follower -> leader: SYNC <epoch> <sequence>  (0 0 for a new follower)
+//  leader -> follower: CATCHUP <epoch> <sequence>, then live records; or
+//   SNAPSHOT <epoch> <sequence>, the book's orders as CREATE parameters, END,
+//   then live records.
+//  A live record: <sequence> <COMMAND> <parameters>.
+// The epoch is random per leader run: sequences from another run (e.g. of a
+//  leader that was restarted) never match.
+
+#pragma once
+
+#include <charconv> // For to_chars().
+#include <coroutine>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility> // For exchange().
+#include <vector>
+#include "../../../event_loop/include/event_loop/event_loop.hpp"
+
+
+class ReplicationLog
+{
+  public:
+    // A follower's connection on the leader.
+    struct Follower
+    {
+        std::string pending; // Records not sent yet.
+        bool dropped{false}; // Too far behind: it has to sync again.
+        std::coroutine_handle<> waiter;
+    };
+
+    // A follower more than this behind is dropped rather than buffered for.
+    static constexpr size_t max_pending{64 << 20};
+
+    explicit ReplicationLog(EventLoop& loop, size_t retained = 1 << 16)
+    : m_loop{loop}, m_retained(retained), m_epoch{std::random_device{}()}
+    {
+        m_epoch = (m_epoch << 32) | std::random_device{}();
+    }
+
+    uint64_t epoch() const
+    {
+        return m_epoch;
+    }
+    // Of the last record, 0 if none yet.
+    uint64_t sequence() const
+    {
+        return m_sequence;
+    }
+
+    // One mutation: the command, then its parameters (strings or integers).
+    template <typename... Args>
+    void record(std::string_view command, const Args&... args);
+
+    // The records after 'sequence' of 'epoch', with their CATCHUP header.
+    //  False if they aren't all retained any more: a snapshot is needed.
+    bool catch_up(uint64_t epoch, uint64_t sequence, std::string& out) const;
+
+    // From the next record on. Removed by remove(), or when dropped.
+    void add(Follower& follower)
+    {
+        m_followers.push_back(&follower);
+    }
+    void remove(Follower& follower);
+
+    // co_await wait(follower): until it has pending records (or is dropped).
+    auto wait(Follower& follower)
+    {
+        struct Awaiter
+        {
+            Follower& follower;
+
+            bool await_ready() const
+            {
+                return !follower.pending.empty() || follower.dropped;
+            }
+            void await_suspend(std::coroutine_handle<> waiter)
+            {
+                follower.waiter = waiter;
+            }
+            void await_resume() const
+            {
+            }
+        };
+        return Awaiter{follower};
+    }
+
+  private:
+    EventLoop& m_loop;
+    // Ring of the last records, by sequence; strings reused, no allocation
+    //  once they've grown.
+    std::vector<std::string> m_retained;
+    uint64_t m_epoch;
+    uint64_t m_sequence{0};
+    std::vector<Follower*> m_followers;
+
+    static void append(std::string& line, std::string_view value)
+    {
+        line += ' ';
+        line += value;
+    }
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    static void append(std::string& line, T value)
+    {
+        char data[24];
+        auto [end, error] = std::to_chars(data, data + sizeof(data), value);
+        line += ' ';
+        line.append(data, end);
+    }
+};
+
+template <typename... Args>
+void ReplicationLog::record(std::string_view command, const Args&... args)
+{
+    m_sequence++;
+    auto& line = m_retained[m_sequence % m_retained.size()];
+    line.clear();
+    char data[24];
+    auto [end, error] = std::to_chars(data, data + sizeof(data), m_sequence);
+    line.append(data, end);
+    append(line, command);
+    (append(line, args), ...);
+    line += '\n';
+
+    for (size_t i = 0; i < m_followers.size(); i++)
+    {
+        auto& follower = *m_followers[i];
+        if (follower.pending.size() + line.size() > max_pending)
+        {
+            follower.dropped = true;
+            follower.pending.clear();
+        }
+        else
+        {
+            follower.pending += line;
+        }
+        // Woken after the current command, not in the middle of it.
+        if (follower.waiter)
+        {
+            m_loop.post(std::exchange(follower.waiter, {}));
+        }
+        if (follower.dropped)
+        {
+            m_followers[i--] = m_followers.back();
+            m_followers.pop_back();
+        }
+    }
+}
+
+bool ReplicationLog::catch_up(uint64_t epoch, uint64_t sequence,
+  std::string& out) const
+{
+    // The ring holds sequences m_sequence - size + 1 .. m_sequence.
+    if (epoch != m_epoch || sequence > m_sequence ||
+      m_sequence - sequence >= m_retained.size())
+    {
+        return false;
+    }
+    out += "CATCHUP ";
+    out += std::to_string(m_epoch);
+    out += ' ';
+    out += std::to_string(sequence);
+    out += '\n';
+    for (auto next = sequence + 1; next <= m_sequence; next++)
+    {
+        out += m_retained[next % m_retained.size()];
+    }
+    return true;
+}
+
+void ReplicationLog::remove(Follower& follower)
+{
+    for (auto& entry : m_followers)
+    {
+        if (entry == &follower)
+        {
+            entry = m_followers.back();
+            m_followers.pop_back();
+            return;
+        }
+    }
+}
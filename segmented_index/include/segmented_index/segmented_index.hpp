@@ -0,0 +1,169 @@
+// Direct index for numeric keys: key => 32-bit value (e.g. an order slot) in a
+//  two-level array, a table of segments of 4096 entries. A lookup is a shift,
+//  a mask and two loads: no hash, no probe, no key comparison.
+// Segments are allocated on first use and given back when their last entry
+//  goes, to a free list they're reused from: with dense, increasing keys (a
+//  gateway's order IDs) memory follows the span of the live keys, not the
+//  highest key ever seen. A fixed index gets all its segments at
+//  construction and never allocates after that; insert() fails when they're
+//  all in use.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+
+class SegmentedIndex
+{
+  public:
+    static constexpr uint32_t none{std::numeric_limits<uint32_t>::max()};
+    static constexpr unsigned segment_bits{12};
+    static constexpr size_t segment_size{size_t{1} << segment_bits};
+
+    // Keys 0..max_key, max_key 0 for a disabled index (no key fits). Fixed:
+    //  'segments' segments and the whole table now, nothing allocated later.
+    //  Otherwise 'segments' is only a hint.
+    explicit SegmentedIndex(uint64_t max_key = 0, size_t segments = 0,
+      bool fixed = false);
+
+    bool enabled() const
+    {
+        return m_max_key != 0;
+    }
+    uint64_t max_key() const
+    {
+        return m_max_key;
+    }
+    // Entries in use.
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // Decimal digits without a leading zero (a key has one spelling), at
+    //  most 19 of them so that it fits: the number in 'key'.
+    static bool parse(std::string_view text, uint64_t& key);
+    // Parsed, and within this index's keys. Always false if disabled.
+    bool fits(std::string_view text, uint64_t& key) const
+    {
+        return enabled() && parse(text, key) && key <= m_max_key;
+    }
+
+    // 'key' <= max_key. none if absent.
+    uint32_t find(uint64_t key) const
+    {
+        auto segment = key >> segment_bits;
+        if (segment >= m_table.size() || m_table[segment] == nullptr)
+        {
+            return none;
+        }
+        return m_table[segment][key & (segment_size - 1)];
+    }
+    // 'key' <= max_key and absent. False if there's no segment for it.
+    bool insert(uint64_t key, uint32_t value);
+    // 'key' <= max_key and present.
+    void erase(uint64_t key);
+
+  private:
+    uint64_t m_max_key;
+    bool m_fixed;
+    size_t m_size{0};
+    // Segment number => its entries, nullptr if not in use.
+    std::vector<uint32_t*> m_table;
+    // Entries in use per segment, for giving it back.
+    std::vector<uint16_t> m_used;
+    std::vector<std::unique_ptr<uint32_t[]>> m_segments;
+    std::vector<uint32_t*> m_free_segments;
+};
+
+SegmentedIndex::SegmentedIndex(uint64_t max_key, size_t segments, bool fixed)
+: m_max_key{max_key}, m_fixed{fixed}
+{
+    if (!enabled())
+    {
+        return;
+    }
+    if (fixed)
+    {
+        m_table.resize((max_key >> segment_bits) + 1, nullptr);
+        m_used.resize(m_table.size(), 0);
+    }
+    m_segments.reserve(segments);
+    m_free_segments.reserve(segments);
+    for (size_t i = 0; fixed && i < segments; i++)
+    {
+        m_segments.push_back(std::make_unique<uint32_t[]>(segment_size));
+        m_free_segments.push_back(m_segments.back().get());
+    }
+}
+
+bool SegmentedIndex::parse(std::string_view text, uint64_t& key)
+{
+    if (text.empty() || text.size() > 19 || (text[0] == '0' &&
+      text.size() > 1))
+    {
+        return false;
+    }
+    key = 0;
+    for (auto c : text)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        key = key * 10 + (c - '0');
+    }
+    return true;
+}
+
+bool SegmentedIndex::insert(uint64_t key, uint32_t value)
+{
+    auto segment = key >> segment_bits;
+    if (segment >= m_table.size())
+    {
+        m_table.resize(segment + 1, nullptr);
+        m_used.resize(segment + 1, 0);
+    }
+    auto& entries = m_table[segment];
+    if (entries == nullptr)
+    {
+        if (!m_free_segments.empty())
+        {
+            entries = m_free_segments.back();
+            m_free_segments.pop_back();
+        }
+        else if (!m_fixed)
+        {
+            m_segments.push_back(std::make_unique<uint32_t[]>(segment_size));
+            entries = m_segments.back().get();
+        }
+        else
+        {
+            return false;
+        }
+        // All bytes 0xff: every entry none.
+        std::memset(entries, 0xff, segment_size * sizeof(uint32_t));
+    }
+    entries[key & (segment_size - 1)] = value;
+    m_used[segment] += 1;
+    m_size += 1;
+    return true;
+}
+
+void SegmentedIndex::erase(uint64_t key)
+{
+    auto segment = key >> segment_bits;
+    m_table[segment][key & (segment_size - 1)] = none;
+    m_size -= 1;
+    if (--m_used[segment] == 0)
+    {
+        m_free_segments.push_back(m_table[segment]);
+        m_table[segment] = nullptr;
+    }
+}
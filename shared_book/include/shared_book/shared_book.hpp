@@ -0,0 +1,324 @@
+// Order Book depth published in POSIX shared memory, for readers on the same
+//  host: they mmap the segment and copy a product's levels directly, with no 
+//  syscall and no parsing. Layout documented in shared_book.md.
+// One writer (the book thread), any number of readers. Each product slot is 
+//  protected by a sequence lock: the writer makes the counter odd, writes, 
+//  makes it even again; a reader retries if the counter was odd or changed 
+//  while it was copying.
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+// POSIX
+#include <sys/mman.h> // For shm_open(), mmap().
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h> // For ftruncate(), close().
+// Custom
+#include "../../../hash_functions/include/wallet/hash_functions.hpp" // xxHash64.
+
+
+struct SharedLevel
+{
+    uint32_t price;
+    uint32_t quantity;
+};
+
+// Fixed-size structs: the layout is an interface between processes.
+struct SharedBookHeader
+{
+    static constexpr uint64_t magic_value{0x4B4F4F42'44524853ULL}; // "SHRDBOOK"
+    static constexpr uint32_t version_value{1};
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t max_products; // Slots, power of 2.
+    uint32_t depth; // Levels per side in every slot.
+    uint32_t slot_size; // Bytes per slot.
+    uint8_t padding[40];
+};
+static_assert(sizeof(SharedBookHeader) == 64);
+
+struct alignas(64) SharedProduct
+{
+    static constexpr size_t depth{16};
+    static constexpr size_t max_id_length{31};
+
+    // Even: stable; odd: write in progress. Also counts the updates (x2).
+    std::atomic<uint64_t> sequence;
+    uint32_t bid_levels; // Valid entries in bids[], best first.
+    uint32_t ask_levels; // Valid entries in asks[], best first.
+    char productID[max_id_length + 1]; // '\0'-terminated, empty if slot free.
+    uint8_t padding[16];
+    SharedLevel bids[depth];
+    SharedLevel asks[depth];
+};
+static_assert(sizeof(SharedProduct) == 320);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+// What a reader gets: a consistent copy of one slot.
+struct SharedBookSnapshot
+{
+    uint64_t sequence;
+    uint32_t bid_levels;
+    uint32_t ask_levels;
+    SharedLevel bids[SharedProduct::depth];
+    SharedLevel asks[SharedProduct::depth];
+};
+
+// Slot of a productID: open addressing with linear probing, starting from its
+//  hash. Same function on both sides, so readers never scan the segment.
+inline uint64_t shared_book_slot_hash(const char* productID, size_t length)
+{
+    return xxHash64::hash(productID, length, 0);
+}
+
+class SharedBookWriter
+{
+  public:
+    // Creates (or recreates) the segment '/name'. max_products rounded up to a
+    //  power of 2.
+    SharedBookWriter(const std::string& name, uint32_t max_products);
+    ~SharedBookWriter();
+    SharedBookWriter(const SharedBookWriter&) = delete;
+    SharedBookWriter& operator=(const SharedBookWriter&) = delete;
+
+    // Levels best first; beyond SharedProduct::depth they are cut. False if 
+    //  the productID is too long or there's no free slot left.
+    bool publish(const std::string& productID, const SharedLevel* bids, 
+      size_t bid_levels, const SharedLevel* asks, size_t ask_levels);
+
+  private:
+    std::string m_name;
+    size_t m_size;
+    void* m_memory;
+    SharedBookHeader* m_header;
+    SharedProduct* m_products;
+
+    SharedProduct* find_or_claim(const std::string& productID);
+};
+
+class SharedBookReader
+{
+  public:
+    explicit SharedBookReader(const std::string& name);
+    ~SharedBookReader();
+    SharedBookReader(const SharedBookReader&) = delete;
+    SharedBookReader& operator=(const SharedBookReader&) = delete;
+
+    // False if the product was never published.
+    bool read(const std::string& productID, SharedBookSnapshot& snapshot) const;
+
+  private:
+    size_t m_size;
+    void* m_memory;
+    const SharedBookHeader* m_header;
+    const SharedProduct* m_products;
+};
+
+SharedBookWriter::SharedBookWriter(const std::string& name, 
+  uint32_t max_products)
+: m_name{name}
+{
+    uint32_t slots = 1;
+    while (slots < max_products)
+    {
+        slots <<= 1;
+    }
+    m_size = sizeof(SharedBookHeader) + slots * sizeof(SharedProduct);
+
+    auto fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error{"shm_open() failed for " + m_name};
+    }
+    if (ftruncate(fd, m_size) != 0)
+    {
+        close(fd);
+        throw std::runtime_error{"ftruncate() failed for " + m_name};
+    }
+    m_memory = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // The mapping keeps the segment alive.
+    if (m_memory == MAP_FAILED)
+    {
+        throw std::runtime_error{"mmap() failed for " + m_name};
+    }
+
+    // ftruncate() zero-fills: every slot starts free with sequence 0.
+    m_header = static_cast<SharedBookHeader*>(m_memory);
+    m_products = reinterpret_cast<SharedProduct*>(
+      static_cast<char*>(m_memory) + sizeof(SharedBookHeader));
+    m_header->version = SharedBookHeader::version_value;
+    m_header->max_products = slots;
+    m_header->depth = SharedProduct::depth;
+    m_header->slot_size = sizeof(SharedProduct);
+    // Magic last: readers check it to know the header is complete.
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = SharedBookHeader::magic_value;
+}
+
+SharedBookWriter::~SharedBookWriter()
+{
+    munmap(m_memory, m_size);
+    shm_unlink(m_name.c_str());
+}
+
+SharedProduct* SharedBookWriter::find_or_claim(const std::string& productID)
+{
+    if (productID.size() > SharedProduct::max_id_length)
+    {
+        return nullptr;
+    }
+
+    const uint32_t mask = m_header->max_products - 1;
+    auto slot = shared_book_slot_hash(productID.data(), productID.size()) & mask;
+    for (uint32_t probe = 0; probe <= mask; probe++, slot = (slot + 1) & mask)
+    {
+        auto& product = m_products[slot];
+        if (product.productID[0] == '\0')
+        {
+            // Claimed under the sequence lock too, so a reader probing this 
+            //  slot never sees half an ID.
+            auto sequence = product.sequence.load(std::memory_order_relaxed);
+            product.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(product.productID, productID.c_str(), 
+              productID.size() + 1);
+            product.sequence.store(sequence + 2, std::memory_order_release);
+            return &product;
+        }
+        if (productID == product.productID)
+        {
+            return &product;
+        }
+    }
+
+    return nullptr;
+}
+
+bool SharedBookWriter::publish(const std::string& productID, 
+  const SharedLevel* bids, size_t bid_levels, const SharedLevel* asks, 
+  size_t ask_levels)
+{
+    auto product = find_or_claim(productID);
+    if (product == nullptr)
+    {
+        return false;
+    }
+
+    bid_levels = std::min(bid_levels, SharedProduct::depth);
+    ask_levels = std::min(ask_levels, SharedProduct::depth);
+
+    auto sequence = product->sequence.load(std::memory_order_relaxed);
+    product->sequence.store(sequence + 1, std::memory_order_relaxed);
+    // Keeps the data stores below the odd counter.
+    std::atomic_thread_fence(std::memory_order_release);
+    product->bid_levels = bid_levels;
+    product->ask_levels = ask_levels;
+    std::memcpy(product->bids, bids, bid_levels * sizeof(SharedLevel));
+    std::memcpy(product->asks, asks, ask_levels * sizeof(SharedLevel));
+    product->sequence.store(sequence + 2, std::memory_order_release);
+
+    return true;
+}
+
+SharedBookReader::SharedBookReader(const std::string& name)
+{
+    auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error{"shm_open() failed for " + name};
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || 
+      static_cast<size_t>(info.st_size) < sizeof(SharedBookHeader))
+    {
+        close(fd);
+        throw std::runtime_error{"Segment too small: " + name};
+    }
+    m_size = info.st_size;
+    m_memory = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m_memory == MAP_FAILED)
+    {
+        throw std::runtime_error{"mmap() failed for " + name};
+    }
+
+    m_header = static_cast<const SharedBookHeader*>(m_memory);
+    if (m_header->magic != SharedBookHeader::magic_value || 
+      m_header->version != SharedBookHeader::version_value || 
+      m_header->slot_size != sizeof(SharedProduct) || 
+      m_size < sizeof(SharedBookHeader) + 
+        size_t{m_header->max_products} * sizeof(SharedProduct))
+    {
+        munmap(m_memory, m_size);
+        throw std::runtime_error{"Not a compatible shared book: " + name};
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    m_products = reinterpret_cast<const SharedProduct*>(
+      static_cast<const char*>(m_memory) + sizeof(SharedBookHeader));
+}
+
+SharedBookReader::~SharedBookReader()
+{
+    munmap(m_memory, m_size);
+}
+
+bool SharedBookReader::read(const std::string& productID, 
+  SharedBookSnapshot& snapshot) const
+{
+    if (productID.size() > SharedProduct::max_id_length)
+    {
+        return false;
+    }
+
+    const uint32_t mask = m_header->max_products - 1;
+    auto slot = shared_book_slot_hash(productID.data(), productID.size()) & mask;
+    for (uint32_t probe = 0; probe <= mask; probe++, slot = (slot + 1) & mask)
+    {
+        const auto& product = m_products[slot];
+        while (true)
+        {
+            auto before = product.sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                continue; // Write in progress.
+            }
+
+            char id[SharedProduct::max_id_length + 1];
+            std::memcpy(id, product.productID, sizeof(id));
+            snapshot.bid_levels = std::min<uint32_t>(product.bid_levels, 
+              SharedProduct::depth);
+            snapshot.ask_levels = std::min<uint32_t>(product.ask_levels, 
+              SharedProduct::depth);
+            std::memcpy(snapshot.bids, product.bids, sizeof(snapshot.bids));
+            std::memcpy(snapshot.asks, product.asks, sizeof(snapshot.asks));
+
+            // Keeps the copies above the second load.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (product.sequence.load(std::memory_order_relaxed) != before)
+            {
+                continue; // Overwritten while copying.
+            }
+
+            id[SharedProduct::max_id_length] = '\0';
+            if (id[0] == '\0')
+            {
+                return false; // Free slot: never published.
+            }
+            if (productID == id)
+            {
+                snapshot.sequence = before;
+                return true;
+            }
+            break; // Someone else's slot: next probe.
+        }
+    }
+
+    return false;
+}
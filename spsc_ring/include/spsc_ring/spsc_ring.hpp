@@ -0,0 +1,105 @@
+// Bounded lock-free queue for exactly one producer thread and one consumer 
+//  thread. No locks, no allocation after construction: push and pop are a 
+//  couple of loads and one release store.
+// Head and tail live on separate cache lines (no False Sharing between the 
+//  two threads), and each side keeps a cached copy of the other side's index,
+//  so it only touches the shared line when the cached value says the ring 
+//  looks full (producer) or empty (consumer).
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+
+
+template <typename T>
+class SpscRing
+{
+  public:
+    // Capacity rounded up to a power of 2: the index wraps with a mask.
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_slots = std::make_unique<T[]>(size);
+    }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side. False if full: the caller decides (drop, retry, ...).
+    bool try_push(const T& item)
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head > m_mask)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head > m_mask)
+            {
+                return false;
+            }
+        }
+        m_slots[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. False if empty.
+    bool try_pop(T& item)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail)
+            {
+                return false;
+            }
+        }
+        item = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: up to max_items in one go, a single release store at the
+    //  end. Returns how many were popped.
+    size_t pop_batch(T* items, size_t max_items)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        size_t count = std::min<size_t>(m_cached_tail - head, max_items);
+        for (size_t i = 0; i < count; i++)
+        {
+            items[i] = m_slots[(head + i) & m_mask];
+        }
+        m_head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate when called concurrently, exact when either side is idle.
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == 
+          m_tail.load(std::memory_order_acquire);
+    }
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+  private:
+    std::unique_ptr<T[]> m_slots;
+    size_t m_mask;
+
+    // Consumer's line.
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_cached_tail{0};
+    // Producer's line.
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_cached_head{0};
+};
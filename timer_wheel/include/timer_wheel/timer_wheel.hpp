@@ -0,0 +1,281 @@
+// Hashed hierarchical timer wheel, for order expiry (good-till-time).
+// Time is cut in ticks (1 ms by default). 4 levels of 64 slots: level k slot s
+//  holds the timers due in the s-th block of 64^k ticks of the current
+//  64^(k+1) block. When time enters a new block, the level above is emptied
+//  into the levels below ("cascade"): each timer moves at most 3 times, so
+//  schedule, cancel and expiry are all O(1) per timer.
+// Timers are identified by a caller-chosen dense uint32_t (the book uses the
+//  order slot) and linked through arrays indexed by it: no node, no
+//  allocation per timer once the arrays cover the ids in use (see reserve()).
+// advance() only moves due timers to an expired list; the caller drains it
+//  with pop_expired(), in batches of its choice.
+
+#pragma once
+
+#include <array>
+#include <bit> // For countr_zero.
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+
+class TimerWheel
+{
+  public:
+    static constexpr size_t levels{4};
+    static constexpr size_t slots{64};
+
+    explicit TimerWheel(uint64_t tick_ns = 1'000'000, uint64_t now_ns = 0)
+    : m_tick_ns{tick_ns}, m_current{now_ns / tick_ns}
+    {
+        m_heads.fill(none);
+    }
+
+    // Ids up to 'ids' - 1 without allocating.
+    void reserve(size_t ids)
+    {
+        m_next.reserve(ids);
+        m_prev.reserve(ids);
+        m_list.reserve(ids);
+        m_deadline.reserve(ids);
+    }
+
+    // 'id' must not be scheduled already. A deadline already past expires at
+    //  the next advance().
+    void schedule(uint32_t id, uint64_t deadline_ns);
+    // Does nothing if 'id' isn't scheduled (or already popped).
+    void cancel(uint32_t id);
+    bool scheduled(uint32_t id) const
+    {
+        return id < m_list.size() && m_list[id] != unlinked;
+    }
+
+    // Of a scheduled 'id', rounded up to its tick.
+    uint64_t deadline_ns(uint32_t id) const
+    {
+        return m_deadline[id] * m_tick_ns;
+    }
+
+    void advance(uint64_t now_ns);
+    // Up to 'max_ids' expired timers, removed from the wheel. Returns how many.
+    size_t pop_expired(uint32_t* ids, size_t max_ids);
+    bool has_expired() const
+    {
+        return m_heads[expired_list] != none;
+    }
+
+    // Scheduled, expired not popped included.
+    size_t size() const
+    {
+        return m_size;
+    }
+
+  private:
+    static constexpr uint32_t none{std::numeric_limits<uint32_t>::max()};
+    // Lists: level * slots + slot, then the expired list.
+    static constexpr uint16_t expired_list{levels * slots};
+    static constexpr uint16_t unlinked{std::numeric_limits<uint16_t>::max()};
+
+    uint64_t m_tick_ns;
+    uint64_t m_current; // Last tick processed.
+    size_t m_size{0};
+    size_t m_pending{0}; // On the wheel, i.e. not expired yet.
+
+    std::array<uint32_t, levels * slots + 1> m_heads;
+    std::array<uint64_t, levels> m_occupied{}; // 1 bit per non-empty slot.
+    // Per id.
+    std::vector<uint32_t> m_next;
+    std::vector<uint32_t> m_prev;
+    std::vector<uint16_t> m_list;
+    std::vector<uint64_t> m_deadline; // In ticks.
+
+    void link(uint32_t id, uint16_t list);
+    void unlink(uint32_t id);
+    // Puts 'id' on the slot its deadline falls in, relative to m_current.
+    void place(uint32_t id);
+    void cascade(size_t level);
+    uint64_t next_event() const;
+};
+
+void TimerWheel::link(uint32_t id, uint16_t list)
+{
+    m_prev[id] = none;
+    m_next[id] = m_heads[list];
+    if (m_heads[list] != none)
+    {
+        m_prev[m_heads[list]] = id;
+    }
+    m_heads[list] = id;
+    m_list[id] = list;
+    if (list != expired_list)
+    {
+        m_occupied[list / slots] |= uint64_t{1} << (list % slots);
+    }
+}
+
+void TimerWheel::unlink(uint32_t id)
+{
+    auto list = m_list[id];
+    if (m_prev[id] != none)
+    {
+        m_next[m_prev[id]] = m_next[id];
+    }
+    else
+    {
+        m_heads[list] = m_next[id];
+    }
+    if (m_next[id] != none)
+    {
+        m_prev[m_next[id]] = m_prev[id];
+    }
+    m_list[id] = unlinked;
+    if (list != expired_list && m_heads[list] == none)
+    {
+        m_occupied[list / slots] &= ~(uint64_t{1} << (list % slots));
+    }
+}
+
+void TimerWheel::place(uint32_t id)
+{
+    const auto deadline = m_deadline[id];
+    if (deadline <= m_current)
+    {
+        m_pending -= 1;
+        link(id, expired_list);
+        return;
+    }
+
+    // The lowest level whose block (64^(level+1) ticks) holds both now and
+    //  the deadline.
+    for (size_t level = 0; level < levels; level++)
+    {
+        auto shift = 6 * (level + 1);
+        if ((deadline >> shift) == (m_current >> shift))
+        {
+            link(id, level * slots + ((deadline >> (6 * level)) & 63));
+            return;
+        }
+    }
+    // Beyond the wheel: parked on the top level's slot 0, which no other 
+    //  timer uses (time is already past it) and which cascades when time 
+    //  enters the next turn of the whole wheel. Placed again then.
+    link(id, (levels - 1) * slots);
+}
+
+void TimerWheel::schedule(uint32_t id, uint64_t deadline_ns)
+{
+    if (id >= m_list.size())
+    {
+        m_next.resize(id + 1);
+        m_prev.resize(id + 1);
+        m_list.resize(id + 1, unlinked);
+        m_deadline.resize(id + 1);
+    }
+    m_deadline[id] = (deadline_ns + m_tick_ns - 1) / m_tick_ns;
+    m_size += 1;
+    m_pending += 1;
+    place(id);
+}
+
+void TimerWheel::cancel(uint32_t id)
+{
+    if (!scheduled(id))
+    {
+        return;
+    }
+    m_pending -= m_list[id] != expired_list;
+    m_size -= 1;
+    unlink(id);
+}
+
+// Empties the slot of 'level' that time just entered into the lower levels,
+//  the levels above first: their timers may land in this very slot.
+void TimerWheel::cascade(size_t level)
+{
+    auto slot = (m_current >> (6 * level)) & 63;
+    if (slot == 0 && level + 1 < levels)
+    {
+        cascade(level + 1);
+    }
+
+    // Detached first: a parked timer still beyond the wheel goes back on 
+    //  this same slot.
+    auto id = m_heads[level * slots + slot];
+    m_heads[level * slots + slot] = none;
+    m_occupied[level] &= ~(uint64_t{1} << slot);
+    while (id != none)
+    {
+        auto next = m_next[id];
+        place(id);
+        id = next;
+    }
+}
+
+// Next tick where something happens: a non-empty level-0 slot, or a cascade
+//  with timers to move. The first level with a non-empty slot later in its 
+//  turn has it; if none has, the wheel's next turn (parked timers). Idle 
+//  stretches are skipped whole, not tick by tick.
+uint64_t TimerWheel::next_event() const
+{
+    for (size_t level = 0; level < levels; level++)
+    {
+        auto shift = 6 * level;
+        auto position = (m_current >> shift) & 63;
+        uint64_t later = position == 63 ? 0 : 
+          m_occupied[level] & (~uint64_t{0} << (position + 1));
+        if (later != 0)
+        {
+            auto turn = (m_current >> (shift + 6)) << (shift + 6);
+            return turn + (uint64_t(std::countr_zero(later)) << shift);
+        }
+    }
+    return ((m_current >> (6 * levels)) + 1) << (6 * levels);
+}
+
+void TimerWheel::advance(uint64_t now_ns)
+{
+    const uint64_t target = now_ns / m_tick_ns;
+    while (m_current < target)
+    {
+        if (m_pending == 0)
+        {
+            m_current = target;
+            break;
+        }
+
+        auto next = next_event();
+        if (next > target)
+        {
+            m_current = target;
+            break;
+        }
+
+        m_current = next;
+        if ((m_current & 63) == 0)
+        {
+            cascade(1);
+        }
+        auto list = m_current & 63;
+        while (m_heads[list] != none)
+        {
+            auto id = m_heads[list];
+            unlink(id);
+            m_pending -= 1;
+            link(id, expired_list);
+        }
+    }
+}
+
+size_t TimerWheel::pop_expired(uint32_t* ids, size_t max_ids)
+{
+    size_t count = 0;
+    while (count < max_ids && m_heads[expired_list] != none)
+    {
+        auto id = m_heads[expired_list];
+        unlink(id);
+        m_size -= 1;
+        ids[count++] = id;
+    }
+    return count;
+}
@@ -0,0 +1,239 @@
+// Per-stage request tracing with the TSC. Every request gets a stamp (rdtsc)
+//  at each stage boundary of the pipeline: read, parse, apply, reply. Stamps go
+//  into a per-thread SPSC ring (no lock, no syscall on the hot path; if the 
+//  ring is full the stamp is dropped and counted, never waited for) and a 
+//  background thread drains all the rings into a binary file. trace_decode 
+//  rebuilds the per-request stage breakdown offline.
+// Compiled in only with -DORDER_BOOK_TRACE: otherwise the macros expand to 
+//  nothing and none of this code is in the hot path.
+//
+// Usage:
+//  TRACE_OPEN("trace.bin");          // Once, at startup.
+//  TRACE_BEGIN(request_id);          // Before reading the request...
+//  TRACE_STAGE(TraceStage::READ);    // ... then at every boundary.
+//  TRACE_REQUEST(request_id);        // Its stages on another thread.
+//  TRACE_CLOSE();                    // Flushes and stops the drainer.
+
+#pragma once
+
+#include <cstdint>
+
+enum class TraceStage : uint8_t
+{
+    BEGIN, // Before waiting for/reading the request.
+    READ, // Request bytes in memory.
+    PARSED, // Tokenized, about to touch the OrderBook.
+    APPLIED, // OrderBook call returned.
+    REPLIED, // Reply written.
+    COUNT // Number of stages, not a stage.
+};
+
+// Binary file: a TraceFileHeader, then TraceRecords in drain order (grouped by
+//  thread, in order within each thread).
+struct TraceFileHeader
+{
+    char magic[8]; // "OBTRACE1"
+    uint64_t tsc_hz; // Calibrated at TRACE_OPEN, to convert ticks to time.
+};
+struct TraceRecord
+{
+    uint64_t tsc;
+    uint64_t request;
+    uint32_t thread;
+    uint8_t stage;
+    uint8_t padding[3];
+};
+static_assert(sizeof(TraceRecord) == 24);
+
+#ifdef ORDER_BOOK_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <x86intrin.h> // For __rdtsc().
+#include "../../../spsc_ring/include/spsc_ring/spsc_ring.hpp"
+
+
+class Tracer
+{
+  public:
+    static constexpr size_t ring_capacity{1 << 16};
+
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    bool open(const std::string& filename);
+    void close();
+
+    void begin(uint64_t request)
+    {
+        t_request = request;
+        stamp(TraceStage::BEGIN);
+    }
+    // A request begun on another thread, continued on this one: the next
+    //  stamps here are its.
+    void resume(uint64_t request)
+    {
+        t_request = request;
+    }
+    // The hot path: rdtsc plus a push in this thread's ring.
+    void stamp(TraceStage stage)
+    {
+        auto ring = t_ring;
+        if (ring == nullptr)
+        {
+            ring = register_thread();
+        }
+        TraceRecord record;
+        record.tsc = __rdtsc();
+        record.request = t_request;
+        record.thread = t_thread;
+        record.stage = static_cast<uint8_t>(stage);
+        if (!ring->try_push(record))
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    Tracer() = default;
+    ~Tracer()
+    {
+        close();
+    }
+
+    SpscRing<TraceRecord>* register_thread();
+    void drain_loop();
+    size_t drain_once();
+    static uint64_t calibrate_tsc_hz();
+
+    std::mutex m_mutex; // Guards m_rings and m_file (cold paths only).
+    std::vector<std::unique_ptr<SpscRing<TraceRecord>>> m_rings;
+    std::FILE* m_file{nullptr};
+    std::thread m_drainer;
+    std::atomic<bool> m_running{false};
+    std::atomic<uint64_t> m_dropped{0};
+
+    static inline thread_local SpscRing<TraceRecord>* t_ring{nullptr};
+    static inline thread_local uint32_t t_thread{0};
+    static inline thread_local uint64_t t_request{0};
+};
+
+uint64_t Tracer::calibrate_tsc_hz()
+{
+    // ~10 ms against steady_clock: good to a few parts in 10^4.
+    auto start_time = std::chrono::steady_clock::now();
+    auto start_tsc = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto end_tsc = __rdtsc();
+    auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time).count();
+    return static_cast<uint64_t>((end_tsc - start_tsc) / elapsed);
+}
+
+bool Tracer::open(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file != nullptr)
+    {
+        return false;
+    }
+    m_file = std::fopen(filename.c_str(), "wb");
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+
+    TraceFileHeader header{{'O', 'B', 'T', 'R', 'A', 'C', 'E', '1'}, 
+      calibrate_tsc_hz()};
+    std::fwrite(&header, sizeof(header), 1, m_file);
+
+    m_running = true;
+    m_drainer = std::thread{&Tracer::drain_loop, this};
+    return true;
+}
+
+void Tracer::close()
+{
+    if (!m_running.exchange(false))
+    {
+        return;
+    }
+    m_drainer.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::fclose(m_file);
+    m_file = nullptr;
+}
+
+SpscRing<TraceRecord>* Tracer::register_thread()
+{
+    // Once per thread. Rings are never freed while the Tracer lives, so the 
+    //  drainer can still empty the ring of a thread that already exited.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_rings.push_back(std::make_unique<SpscRing<TraceRecord>>(ring_capacity));
+    t_ring = m_rings.back().get();
+    t_thread = m_rings.size();
+    return t_ring;
+}
+
+size_t Tracer::drain_once()
+{
+    constexpr size_t batch_size = 4096;
+    static TraceRecord batch[batch_size]; // Drainer thread only.
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t drained = 0;
+    for (auto& ring : m_rings)
+    {
+        size_t count;
+        while ((count = ring->pop_batch(batch, batch_size)) > 0)
+        {
+            std::fwrite(batch, sizeof(TraceRecord), count, m_file);
+            drained += count;
+        }
+    }
+    return drained;
+}
+
+void Tracer::drain_loop()
+{
+    while (m_running.load(std::memory_order_relaxed))
+    {
+        if (drain_once() == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    drain_once(); // Whatever arrived before close().
+    std::fflush(m_file);
+}
+
+#define TRACE_OPEN(filename) Tracer::instance().open(filename)
+#define TRACE_CLOSE() Tracer::instance().close()
+#define TRACE_BEGIN(request) Tracer::instance().begin(request)
+#define TRACE_REQUEST(request) Tracer::instance().resume(request)
+#define TRACE_STAGE(stage) Tracer::instance().stamp(stage)
+
+#else
+
+#define TRACE_OPEN(filename) ((void)0)
+#define TRACE_CLOSE() ((void)0)
+#define TRACE_BEGIN(request) ((void)0)
+#define TRACE_REQUEST(request) ((void)0)
+#define TRACE_STAGE(stage) ((void)0)
+
+#endif
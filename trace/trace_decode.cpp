@@ -0,0 +1,133 @@
+// Offline decoder for the trace files written with -DORDER_BOOK_TRACE (see 
+//  trace.hpp): rebuilds each request from its stage stamps and prints the 
+//  time spent between consecutive stages, as percentiles and optionally one 
+//  line per request.
+// Usage: trace_decode <file> [requests]
+
+// C++ standard
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <string>
+// Custom
+#include "include/trace/trace.hpp"
+
+
+constexpr size_t stage_count = static_cast<size_t>(TraceStage::COUNT);
+
+// Intervals between consecutive stages: [i] ends at stage i+1.
+static const char* interval_names[stage_count - 1] = {"read", "parse", "apply",
+  "reply"};
+
+struct Request
+{
+    uint64_t tsc[stage_count] = {}; // 0: stage not stamped (or dropped).
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: trace_decode <file> [requests]\n";
+        return 1;
+    }
+    bool per_request = argc > 2 && std::string{argv[2]} == "requests";
+
+    std::ifstream file{argv[1], std::ios::binary};
+    TraceFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || 
+      std::memcmp(header.magic, "OBTRACE1", 8) != 0)
+    {
+        std::cerr << "Not a trace file: " << argv[1] << "\n";
+        return 1;
+    }
+    const double ns_per_tick = 1e9 / header.tsc_hz;
+
+    // Request => stamps. The front end numbers the requests; a request's 
+    //  stamps may come from two threads (e.g. the book thread's PARSED and 
+    //  APPLIED): the TSC is the same clock on every core.
+    std::map<uint64_t, Request> requests;
+    TraceRecord record;
+    size_t records = 0;
+    while (file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        records++;
+        if (record.stage < stage_count)
+        {
+            requests[record.request].tsc[record.stage] = 
+              record.tsc;
+        }
+    }
+
+    std::vector<double> intervals[stage_count - 1];
+    std::vector<double> service; // READ to REPLIED: without the idle wait.
+    for (const auto& [key, request] : requests)
+    {
+        if (per_request)
+        {
+            std::cout << "request " << key;
+        }
+        for (size_t i = 0; i + 1 < stage_count; i++)
+        {
+            if (request.tsc[i] == 0 || request.tsc[i + 1] == 0)
+            {
+                if (per_request)
+                {
+                    std::cout << " " << interval_names[i] << "=?";
+                }
+                continue;
+            }
+            double ns = (request.tsc[i + 1] - request.tsc[i]) * ns_per_tick;
+            intervals[i].push_back(ns);
+            if (per_request)
+            {
+                std::cout << " " << interval_names[i] << "=" << std::fixed 
+                  << std::setprecision(0) << ns;
+            }
+        }
+        auto read = request.tsc[static_cast<size_t>(TraceStage::READ)];
+        auto replied = request.tsc[static_cast<size_t>(TraceStage::REPLIED)];
+        if (read != 0 && replied != 0)
+        {
+            service.push_back((replied - read) * ns_per_tick);
+        }
+        if (per_request)
+        {
+            std::cout << "\n";
+        }
+    }
+
+    std::cout << records << " stamps, " << requests.size() << " requests, TSC "
+      << header.tsc_hz / 1e6 << " MHz\n";
+    std::cout << "  " << std::left << std::setw(10) << "stage" << std::right 
+      << std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) 
+      << "p90" << std::setw(10) << "p99" << std::setw(12) << "max" 
+      << "   (ns)\n";
+    auto print = [](const char* name, std::vector<double>& samples) {
+        if (samples.empty())
+        {
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](double p) {
+            return samples[std::min(samples.size() - 1, 
+              static_cast<size_t>(p * samples.size()))];
+        };
+        std::cout << "  " << std::left << std::setw(10) << name << std::right 
+          << std::setw(10) << samples.size() << std::fixed 
+          << std::setprecision(0) << std::setw(10) << percentile(0.5) 
+          << std::setw(10) << percentile(0.9) << std::setw(10) 
+          << percentile(0.99) << std::setw(12) << samples.back() << "\n";
+    };
+    for (size_t i = 0; i + 1 < stage_count; i++)
+    {
+        print(interval_names[i], intervals[i]);
+    }
+    print("service", service);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Per-product trade tape: the last trades in a ring, and time bars (OHLCV and
+//  VWAP) for a few intervals, each a ring of the last bars. A trade updates
+//  the current bar of every interval in place, or opens the next one: O(1)
+//  per trade and interval, and reading the bars is a copy, no scan of the
+//  trades. Everything is allocated by the constructor.
+// Bars are aligned on multiples of their interval since the epoch (a minute
+//  bar starts on a minute of UTC), and only exist for intervals that had
+//  trades: no empty bars in between.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+class TradeTape
+{
+  public:
+    struct Trade
+    {
+        uint64_t time_ns; // Wall clock, ns since the epoch.
+        uint32_t price;
+        uint32_t quantity;
+    };
+    struct Bar
+    {
+        uint64_t start_ns;
+        uint32_t open;
+        uint32_t high;
+        uint32_t low;
+        uint32_t close;
+        uint64_t volume;
+        uint64_t notional; // Sum of price * quantity, for the VWAP.
+        uint32_t trades;
+
+        double vwap() const
+        {
+            return double(notional) / double(volume);
+        }
+    };
+
+    struct Config
+    {
+        std::vector<uint64_t> intervals_ns{1'000'000'000, 60'000'000'000};
+        size_t trades{256}; // Rounded up to a power of 2.
+        size_t bars{64}; // Per interval.
+    };
+
+    explicit TradeTape(const Config& config);
+
+    // A trade at 'time_ns'. One older than an interval's current bar (the
+    //  wall clock stepped back) goes into that bar.
+    void add(const Trade& trade);
+
+    const std::vector<uint64_t>& intervals_ns() const
+    {
+        return m_intervals_ns;
+    }
+    // Index of the interval of 'interval_ns', intervals_ns().size() if none.
+    size_t interval(uint64_t interval_ns) const
+    {
+        return std::find(m_intervals_ns.begin(), m_intervals_ns.end(),
+          interval_ns) - m_intervals_ns.begin();
+    }
+
+    // The newest first, up to 'max_count'. Return how many.
+    size_t last_trades(Trade* trades, size_t max_count) const;
+    size_t last_bars(size_t interval, Bar* bars, size_t max_count) const;
+
+  private:
+    std::vector<uint64_t> m_intervals_ns;
+    std::vector<Trade> m_trades;
+    uint64_t m_trade_count{0};
+    // Interval i's ring: m_bars[i * m_bars_per_interval ...].
+    std::vector<Bar> m_bars;
+    size_t m_bars_per_interval;
+    std::vector<uint64_t> m_bar_counts; // Per interval, since the start.
+};
+
+TradeTape::TradeTape(const Config& config)
+: m_intervals_ns{config.intervals_ns},
+  m_bars(config.intervals_ns.size() * config.bars),
+  m_bars_per_interval{config.bars}, m_bar_counts(config.intervals_ns.size())
+{
+    size_t size = 1;
+    while (size < config.trades)
+    {
+        size <<= 1;
+    }
+    m_trades.resize(size);
+}
+
+void TradeTape::add(const Trade& trade)
+{
+    m_trades[m_trade_count++ & (m_trades.size() - 1)] = trade;
+
+    const uint64_t notional = uint64_t{trade.price} * trade.quantity;
+    for (size_t i = 0; i < m_intervals_ns.size(); i++)
+    {
+        auto* ring = &m_bars[i * m_bars_per_interval];
+        auto& count = m_bar_counts[i];
+        const auto start = trade.time_ns - trade.time_ns % m_intervals_ns[i];
+        if (count != 0)
+        {
+            auto& bar = ring[(count - 1) % m_bars_per_interval];
+            if (start <= bar.start_ns)
+            {
+                bar.high = std::max(bar.high, trade.price);
+                bar.low = std::min(bar.low, trade.price);
+                bar.close = trade.price;
+                bar.volume += trade.quantity;
+                bar.notional += notional;
+                bar.trades += 1;
+                continue;
+            }
+        }
+        ring[count++ % m_bars_per_interval] = {start, trade.price,
+          trade.price, trade.price, trade.price, trade.quantity, notional, 1};
+    }
+}
+
+size_t TradeTape::last_trades(Trade* trades, size_t max_count) const
+{
+    auto count = std::min<uint64_t>({max_count, m_trade_count,
+      m_trades.size()});
+    for (size_t i = 0; i < count; i++)
+    {
+        trades[i] = m_trades[(m_trade_count - 1 - i) & (m_trades.size() - 1)];
+    }
+    return count;
+}
+
+size_t TradeTape::last_bars(size_t interval, Bar* bars, size_t max_count)
+  const
+{
+    const auto* ring = &m_bars[interval * m_bars_per_interval];
+    const auto total = m_bar_counts[interval];
+    auto count = std::min<uint64_t>({max_count, total, m_bars_per_interval});
+    for (size_t i = 0; i < count; i++)
+    {
+        bars[i] = ring[(total - 1 - i) % m_bars_per_interval];
+    }
+    return count;
+}